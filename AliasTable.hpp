@@ -0,0 +1,71 @@
+#pragma once
+#ifndef RAYTRACING_ALIASTABLE_H
+#define RAYTRACING_ALIASTABLE_H
+
+#include <vector>
+#include <algorithm>
+
+// Walker/Vose alias table: O(n) construction from non-negative weights and
+// O(1) sampling of an index with probability proportional to its weight
+class AliasTable
+{
+public:
+    AliasTable() {}
+    explicit AliasTable(const std::vector<float> &weights) { build(weights); }
+
+    void build(const std::vector<float> &weights)
+    {
+        int n = weights.size();
+        prob.assign(n, 0.0f);
+        alias.assign(n, 0);
+        pmfs.assign(n, 0.0f);
+
+        double sum = 0;
+        for (float w : weights) sum += std::max(w, 0.0f);
+        if (n == 0 || sum <= 0) {
+            prob.clear(); alias.clear(); pmfs.clear();
+            return;
+        }
+
+        std::vector<double> scaled(n);
+        std::vector<int> small, large;
+        for (int i = 0; i < n; ++i) {
+            pmfs[i] = std::max(weights[i], 0.0f) / sum;
+            scaled[i] = pmfs[i] * n;
+            if (scaled[i] < 1.0) small.push_back(i);
+            else large.push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            int s = small.back(); small.pop_back();
+            int l = large.back(); large.pop_back();
+            prob[s] = scaled[s];
+            alias[s] = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+            if (scaled[l] < 1.0) small.push_back(l);
+            else large.push_back(l);
+        }
+        // whatever is left is 1 up to rounding error
+        for (int i : large) { prob[i] = 1.0f; alias[i] = i; }
+        for (int i : small) { prob[i] = 1.0f; alias[i] = i; }
+    }
+
+    // map a uniform number in [0, 1) to an index
+    int sample(float u) const
+    {
+        int n = prob.size();
+        float x = u * n;
+        int i = std::min(int(x), n - 1);
+        return (x - i < prob[i]) ? i : alias[i];
+    }
+
+    float pmf(int i) const { return pmfs[i]; }
+    int size() const { return prob.size(); }
+    bool empty() const { return prob.empty(); }
+
+private:
+    std::vector<float> prob;
+    std::vector<int> alias;
+    std::vector<float> pmfs;
+};
+
+#endif //RAYTRACING_ALIASTABLE_H
@@ -2,94 +2,217 @@
 #include <cassert>
 #include "BVH.hpp"
 
+// Number of objects in [begin, end), sorted by centroid along dim, to put
+// in the left half, so that the surface area heuristic cost of the two
+// halves is lowest. The
+// candidates are the boundaries of equally sized buckets over the
+// centroid bounds; falls back to the median if all centroids fall into
+// one bucket.
+static size_t sahSplit(Object* const* begin, Object* const* end,
+                       const Bounds3& centroidBounds, int dim)
+{
+    const int nBuckets = 12;
+    int count[nBuckets] = {};
+    Bounds3 bucketBounds[nBuckets];
+    for (Object* const* object = begin; object != end; ++object) {
+        Bounds3 b = (*object)->getBounds();
+        int k = int(nBuckets * centroidBounds.Offset(b.Centroid())[dim]);
+        k = std::max(0, std::min(nBuckets - 1, k));
+        ++count[k];
+        bucketBounds[k] = Union(bucketBounds[k], b);
+    }
+
+    // areas of everything right of each bucket boundary
+    float rightArea[nBuckets];
+    int rightCount[nBuckets];
+    Bounds3 right;
+    int n = 0;
+    for (int k = nBuckets - 1; k > 0; --k) {
+        right = Union(right, bucketBounds[k]);
+        n += count[k];
+        rightArea[k] = right.SurfaceArea();
+        rightCount[k] = n;
+    }
+
+    Bounds3 left;
+    int leftCount = 0;
+    float bestCost = std::numeric_limits<float>::infinity();
+    size_t best = (end - begin) / 2;
+    for (int k = 1; k < nBuckets; ++k) {
+        left = Union(left, bucketBounds[k - 1]);
+        leftCount += count[k - 1];
+        if (leftCount == 0 || rightCount[k] == 0)
+            continue;
+        float cost = leftCount * left.SurfaceArea() + rightCount[k] * rightArea[k];
+        if (cost < bestCost) {
+            bestCost = cost;
+            best = leftCount;
+        }
+    }
+    return best;
+}
+
 BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
                    SplitMethod splitMethod)
-    : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod),
-      primitives(std::move(p))
+    : root(nullptr), maxPrimsInNode(std::min(255, maxPrimsInNode)),
+      splitMethod(splitMethod), primitives(std::move(p))
 {
-    time_t start, stop;
-    time(&start);
+    auto start = std::chrono::steady_clock::now();
+    Rebuild();
+    if (!root)
+        return;
+
+    // only the first build is reported, not the rebuilds of Update
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    printf("\rBVH Generation complete: \nTime Taken: %.2f ms, %.1f KB of nodes\n\n",
+           elapsed.count(), arena.TotalAllocated() / 1024.0);
+}
+
+void BVHAccel::Rebuild()
+{
+    arena.Rewind();
+    root = nullptr;
+    depth = 0;
     if (primitives.empty())
         return;
 
-    root = recursiveBuild(primitives);
+    root = recursiveBuild(0, primitives.size());
+    builtCost = SAHCost();
+}
 
-    time(&stop);
-    double diff = difftime(stop, start);
-    int hrs = (int)diff / 3600;
-    int mins = ((int)diff / 60) - (hrs * 60);
-    int secs = (int)diff - (hrs * 3600) - (mins * 60);
+static bool sameBounds(const Bounds3& a, const Bounds3& b)
+{
+    return a.pMin.x == b.pMin.x && a.pMin.y == b.pMin.y && a.pMin.z == b.pMin.z &&
+           a.pMax.x == b.pMax.x && a.pMax.y == b.pMax.y && a.pMax.z == b.pMax.z;
+}
 
-    printf(
-        "\rBVH Generation complete: \nTime Taken: %i hrs, %i mins, %i secs\n\n",
-        hrs, mins, secs);
+static void setLeafBounds(BVHBuildNode* node)
+{
+    node->bounds = node->object->getBounds();
+    node->endBounds = node->object->getEndBounds();
+    node->moving = !sameBounds(node->bounds, node->endBounds);
 }
 
-BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
+static void setInteriorBounds(BVHBuildNode* node)
 {
-    BVHBuildNode* node = new BVHBuildNode();
+    node->bounds = Union(node->left->bounds, node->right->bounds);
+    node->endBounds = Union(node->left->endBounds, node->right->endBounds);
+    node->moving = node->left->moving || node->right->moving;
+}
 
-    // Compute bounds of all primitives in BVH node
-    Bounds3 bounds;
-    for (int i = 0; i < objects.size(); ++i)
-        bounds = Union(bounds, objects[i]->getBounds());
-    if (objects.size() == 1) {
+// Recomputes the bounds and areas of the subtree from its primitives,
+// children first. The topology is kept.
+static void refitNode(BVHBuildNode* node)
+{
+    if (node->object) {
+        setLeafBounds(node);
+        node->area = node->object->getArea();
+        return;
+    }
+    refitNode(node->left);
+    refitNode(node->right);
+    setInteriorBounds(node);
+    node->area = node->left->area + node->right->area;
+}
+
+void BVHAccel::Refit()
+{
+    if (root)
+        refitNode(root);
+}
+
+bool BVHAccel::Update(float maxCostRatio)
+{
+    Refit();
+    if (!root || maxCostRatio <= 0 || SAHCost() <= maxCostRatio * builtCost)
+        return false;
+    Rebuild();
+    return true;
+}
+
+// Sum of the surface areas of all nodes, leaves included since each holds
+// exactly one primitive: the expected number of node and primitive tests
+// of a random ray, up to the surface area of the root.
+static float sahCost(const BVHBuildNode* node)
+{
+    if (node->object)
+        return node->bounds.SurfaceArea();
+    return node->bounds.SurfaceArea() + sahCost(node->left) + sahCost(node->right);
+}
+
+float BVHAccel::SAHCost() const
+{
+    if (!root || root->bounds.SurfaceArea() <= 0)
+        return 0;
+    return sahCost(root) / root->bounds.SurfaceArea();
+}
+
+// Builds the subtree over primitives[begin, end), reordering that range in
+// place. Nodes come from the arena in depth first order, so a parent and
+// its left child are usually adjacent in memory.
+BVHBuildNode* BVHAccel::recursiveBuild(int begin, int end, int level)
+{
+    BVHBuildNode* node = arena.Alloc<BVHBuildNode>();
+    depth = std::max(depth, level);
+    Object** objects = primitives.data() + begin;
+    int size = end - begin;
+
+    if (size == 1) {
         // Create leaf _BVHBuildNode_
-        node->bounds = objects[0]->getBounds();
         node->object = objects[0];
+        setLeafBounds(node);
         node->left = nullptr;
         node->right = nullptr;
         node->area = objects[0]->getArea();
         return node;
     }
-    else if (objects.size() == 2) {
-        node->left = recursiveBuild(std::vector<Object *>{objects[0]});
-        node->right = recursiveBuild(std::vector<Object *>{objects[1]});
+    else if (size == 2) {
+        node->left = recursiveBuild(begin, begin + 1, level + 1);
+        node->right = recursiveBuild(begin + 1, end, level + 1);
 
-        node->bounds = Union(node->left->bounds, node->right->bounds);
+        setInteriorBounds(node);
         node->area = node->left->area + node->right->area;
         return node;
     }
     else {
         Bounds3 centroidBounds;
-        for (int i = 0; i < objects.size(); ++i)
+        for (int i = 0; i < size; ++i)
             centroidBounds =
                 Union(centroidBounds, objects[i]->getBounds().Centroid());
         int dim = centroidBounds.maxExtent();
+        node->splitAxis = dim;
         switch (dim) {
         case 0:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
+            std::sort(objects, objects + size, [](auto f1, auto f2) {
                 return f1->getBounds().Centroid().x <
                        f2->getBounds().Centroid().x;
             });
             break;
         case 1:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
+            std::sort(objects, objects + size, [](auto f1, auto f2) {
                 return f1->getBounds().Centroid().y <
                        f2->getBounds().Centroid().y;
             });
             break;
         case 2:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
+            std::sort(objects, objects + size, [](auto f1, auto f2) {
                 return f1->getBounds().Centroid().z <
                        f2->getBounds().Centroid().z;
             });
             break;
         }
 
-        auto beginning = objects.begin();
-        auto middling = objects.begin() + (objects.size() / 2);
-        auto ending = objects.end();
+        int middling = begin + size / 2;
+        if (splitMethod == SplitMethod::SAH)
+            middling = begin + sahSplit(objects, objects + size, centroidBounds, dim);
 
-        auto leftshapes = std::vector<Object*>(beginning, middling);
-        auto rightshapes = std::vector<Object*>(middling, ending);
+        assert(begin < middling && middling < end);
 
-        assert(objects.size() == (leftshapes.size() + rightshapes.size()));
+        node->left = recursiveBuild(begin, middling, level + 1);
+        node->right = recursiveBuild(middling, end, level + 1);
 
-        node->left = recursiveBuild(leftshapes);
-        node->right = recursiveBuild(rightshapes);
-
-        node->bounds = Union(node->left->bounds, node->right->bounds);
+        setInteriorBounds(node);
         node->area = node->left->area + node->right->area;
     }
 
@@ -98,42 +221,197 @@ BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
 
 Intersection BVHAccel::Intersect(const Ray& ray) const
 {
-    Intersection isect;
+    // traverse with a slim hit record, then build the surface interaction
+    // once for the closest hit
+    HitRecord hit;
+    if (!Intersect(ray, hit))
+        return Intersection();
+    return hit.prim->getSurfaceInteraction(ray, hit);
+}
+
+bool BVHAccel::Intersect(const Ray& ray, HitRecord& hit) const
+{
+    return Intersect(ray, RayShear(ray.direction), hit);
+}
+
+bool BVHAccel::Intersect(const Ray& ray, const RayShear& shear,
+                         HitRecord& hit) const
+{
     if (!root)
-        return isect;
-    isect = BVHAccel::getIntersection(root, ray);
-    return isect;
+        return false;
+    hit.t = std::min(hit.t, ray.t_max);
+    if (!root->boundsAt(ray.t).IntersectP(ray, hit.t))
+        return false;
+    return getIntersection(root, ray, shear, hit);
 }
 
-Intersection BVHAccel::getIntersection(BVHBuildNode* node, const Ray& ray) const
+bool BVHAccel::getIntersection(BVHBuildNode* node, const Ray& ray,
+                               const RayShear& shear, HitRecord& hit) const
 {
-    // TODO Traverse the BVH to find intersection
+    STAT_ADD(nodeVisits, 1);
+    if (node->object) {
+        return node->object->intersect(ray, shear, hit);
+    }
+
+    // visit the child on the near side of the split first, so that its hits
+    // shrink hit.t and can cull the far child
+    BVHBuildNode* first = node->left;
+    BVHBuildNode* second = node->right;
+    if (ray.dirIsNeg[node->splitAxis]) {
+        std::swap(first, second);
+    }
+
+    bool found = false;
+    if (first && first->boundsAt(ray.t).IntersectP(ray, hit.t)) {
+        found |= getIntersection(first, ray, shear, hit);
+    }
+
+    if (second && second->boundsAt(ray.t).IntersectP(ray, hit.t)) {
+        found |= getIntersection(second, ray, shear, hit);
+    }
+
+    return found;
+}
 
+bool BVHAccel::IntersectP(const Ray& ray) const
+{
+    return IntersectP(ray, RayShear(ray.direction));
+}
+
+bool BVHAccel::IntersectP(const Ray& ray, const RayShear& shear) const
+{
+    return root && getIntersectionP(root, ray, shear);
+}
+
+bool BVHAccel::getIntersectionP(BVHBuildNode* node, const Ray& ray,
+                                const RayShear& shear) const
+{
+    // any hit in (t_min, t_max) will do, stop at the first one
+    STAT_ADD(nodeVisits, 1);
+    if (!node->boundsAt(ray.t).IntersectP(ray, ray.t_max)) {
+        return false;
+    }
     if (node->object) {
-        return node->object->getIntersection(ray);
+        return node->object->occluded(ray, shear);
     }
+    return (node->left && getIntersectionP(node->left, ray, shear)) ||
+           (node->right && getIntersectionP(node->right, ray, shear));
+}
 
-    std::array<int, 3> dirNeg = {ray.direction.x < 0, 
-        ray.direction.y < 0, ray.direction.z < 0};
+namespace {
 
-    Intersection result;
-    if (node->left && node->left->bounds.IntersectP(
-        ray, ray.direction_inv, dirNeg)) {
-        result = getIntersection(node->left, ray);
+// Stack of the packet traversals. The children of a node replace it, so it
+// never holds more than depth + 1 nodes; SAH splits can leave trees deeper
+// than the fixed buffer, which are given a heap allocated one.
+class NodeStack {
+public:
+    explicit NodeStack(int depth) : nodes(fixed)
+    {
+        if (depth + 1 > FIXED) {
+            grown.resize(depth + 1);
+            nodes = grown.data();
+        }
     }
+    NodeStack(const NodeStack&) = delete;
+    NodeStack& operator=(const NodeStack&) = delete;
+
+    void push(BVHBuildNode* node) { nodes[top++] = node; }
+    BVHBuildNode* pop() { return nodes[--top]; }
+    bool empty() const { return top == 0; }
 
-    if (node->right && node->right->bounds.IntersectP(
-        ray, ray.direction_inv, dirNeg)) {
+private:
+    static const int FIXED = 64;
+    BVHBuildNode* fixed[FIXED];
+    std::vector<BVHBuildNode*> grown;
+    BVHBuildNode** nodes;
+    int top = 0;
+};
 
-        auto right_result = getIntersection(node->right, ray);
-        if (result.distance > right_result.distance) {
-            result = right_result;
+} // namespace
+
+// Packet traversal: every node is fetched once for the whole packet and
+// tested against all lanes. Lanes that miss a node, or already have a hit in
+// front of it, are masked off for that subtree. Once a single lane is left
+// the packet has diverged and that lane continues with the scalar traversal.
+void BVHAccel::IntersectPacket(const RayPacket &packet, const bool *active,
+                               HitRecord *hits) const
+{
+    if (!root)
+        return;
+
+    NodeStack stack(depth);
+    stack.push(root);
+
+    float tMax[RayPacket::SIZE];
+    bool mask[RayPacket::SIZE];
+    for (int i = 0; i < RayPacket::SIZE; ++i)
+        hits[i].t = std::min(hits[i].t, packet.tmax[i]);
+    while (!stack.empty()) {
+        BVHBuildNode* node = stack.pop();
+        STAT_ADD(nodeVisits, 1);
+        for (int i = 0; i < RayPacket::SIZE; ++i)
+            tMax[i] = hits[i].t;
+        int count = node->boundsAt(packet.time).IntersectP(packet, active, tMax, mask);
+        if (count == 0)
+            continue;
+
+        if (node->object) {
+            node->object->intersect(packet, mask, hits);
+        }
+        else if (count == 1) {
+            int lane = 0;
+            while (!mask[lane]) ++lane;
+            getIntersection(node, packet.ray(lane), packet.shear(lane), hits[lane]);
+        }
+        else {
+            if (node->right) stack.push(node->right);
+            if (node->left) stack.push(node->left);
         }
     }
-    
-    return result;
 }
 
+// The any hit version of IntersectPacket: a lane drops out as soon as it is
+// found blocked, and the traversal ends once every lane is.
+void BVHAccel::OccludedPacket(const RayPacket &packet, const bool *active,
+                              bool *occluded) const
+{
+    if (!root)
+        return;
+
+    NodeStack stack(depth);
+    stack.push(root);
+
+    bool alive[RayPacket::SIZE], mask[RayPacket::SIZE];
+    while (!stack.empty()) {
+        int remaining = 0;
+        for (int i = 0; i < RayPacket::SIZE; ++i) {
+            alive[i] = active[i] && !occluded[i];
+            remaining += alive[i];
+        }
+        if (remaining == 0)
+            return;
+
+        BVHBuildNode* node = stack.pop();
+        STAT_ADD(nodeVisits, 1);
+        int count = node->boundsAt(packet.time).IntersectP(packet, alive, packet.tmax, mask);
+        if (count == 0)
+            continue;
+
+        if (node->object) {
+            node->object->occluded(packet, mask, occluded);
+        }
+        else if (count == 1) {
+            int lane = 0;
+            while (!mask[lane]) ++lane;
+            occluded[lane] = getIntersectionP(node, packet.ray(lane),
+                                              packet.shear(lane));
+        }
+        else {
+            if (node->right) stack.push(node->right);
+            if (node->left) stack.push(node->left);
+        }
+    }
+}
 
 void BVHAccel::getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf){
     if(node->left == nullptr || node->right == nullptr){
@@ -146,7 +424,7 @@ void BVHAccel::getSample(BVHBuildNode* node, float p, Intersection &pos, float &
 }
 
 void BVHAccel::Sample(Intersection &pos, float &pdf){
-    float p = std::sqrt(get_random_float()) * root->area;
+    float p = get_random_float() * root->area;
     getSample(root, p, pos, pdf);
     pdf /= root->area;
 }
\ No newline at end of file
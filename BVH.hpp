@@ -8,7 +8,9 @@
 #include <atomic>
 #include <vector>
 #include <memory>
-#include <ctime>
+#include <chrono>
+#include "MemoryArena.hpp"
+#include "Stats.hpp"
 #include "Object.hpp"
 #include "Ray.hpp"
 #include "Bounds3.hpp"
@@ -30,20 +32,53 @@ public:
     // BVHAccel Public Methods
     BVHAccel(std::vector<Object*> p, int maxPrimsInNode = 1, SplitMethod splitMethod = SplitMethod::NAIVE);
     Bounds3 WorldBound() const;
-    ~BVHAccel();
+
+    // For primitives that moved without changing the topology of the
+    // scene: Refit recomputes the node bounds bottom-up in O(n), Rebuild
+    // builds a new tree over the same primitives, in the node memory of
+    // the old one. Update refits and
+    // rebuilds only if the SAH cost grew by more than maxCostRatio times
+    // the cost after the last build (never, if maxCostRatio <= 0);
+    // returns true if it rebuilt.
+    void Refit();
+    void Rebuild();
+    bool Update(float maxCostRatio = 2.0f);
+    // expected node and primitive tests of a ray that hits the root bounds
+    float SAHCost() const;
 
     Intersection Intersect(const Ray &ray) const;
-    Intersection getIntersection(BVHBuildNode* node, const Ray& ray)const;
+    // closest hit traversal, returns true if hit was updated
+    bool Intersect(const Ray &ray, HitRecord &hit) const;
+    // the same with the shear of the ray already computed
+    bool Intersect(const Ray &ray, const RayShear &shear, HitRecord &hit) const;
+    bool getIntersection(BVHBuildNode* node, const Ray& ray,
+                         const RayShear &shear, HitRecord &hit) const;
+    // closest hits of a coherent packet, updating hits of the active lanes
+    void IntersectPacket(const RayPacket &packet, const bool *active,
+                         HitRecord *hits) const;
+    // any hit in each active lane's (tmin, tmax), setting occluded[i] for
+    // the lanes blocked; blocked lanes stop traversing
+    void OccludedPacket(const RayPacket &packet, const bool *active,
+                        bool *occluded) const;
+    // any hit in (t_min, t_max), for visibility tests
     bool IntersectP(const Ray &ray) const;
+    bool IntersectP(const Ray &ray, const RayShear &shear) const;
+    bool getIntersectionP(BVHBuildNode* node, const Ray& ray,
+                          const RayShear &shear) const;
     BVHBuildNode* root;
 
     // BVHAccel Private Methods
-    BVHBuildNode* recursiveBuild(std::vector<Object*>objects);
+    BVHBuildNode* recursiveBuild(int begin, int end, int level = 0);
 
     // BVHAccel Private Data
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
     std::vector<Object*> primitives;
+    float builtCost = 0;
+    // levels below the root, which bounds the packet traversal stacks
+    int depth = 0;
+    // owns the nodes, which are freed together with the BVH
+    MemoryArena arena;
 
     void getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf);
     void Sample(Intersection &pos, float &pdf);
@@ -51,13 +86,22 @@ public:
 
 struct BVHBuildNode {
     Bounds3 bounds;
+    // bounds at the end of the shutter, only used if moving
+    Bounds3 endBounds;
     BVHBuildNode *left;
     BVHBuildNode *right;
     Object* object;
     float area;
+    bool moving = false;
 
 public:
     int splitAxis=0, firstPrimOffset=0, nPrimitives=0;
+    // bounds at shutter time (0 = open, 1 = close), so that moving
+    // geometry is not bounded by its whole swept volume
+    Bounds3 boundsAt(float time) const
+    {
+        return moving ? Lerp(bounds, endBounds, time) : bounds;
+    }
     // BVHBuildNode Public Methods
     BVHBuildNode(){
         bounds = Bounds3();
@@ -0,0 +1,376 @@
+// Microbenchmarks of the renderer's kernels on the bundled models: BVH
+// build per split method, closest-hit and any-hit traversal, the triangle
+// test and the material sample/pdf/eval calls. Everything runs on one
+// thread; each figure is the fastest of several repetitions. Results are
+// printed and written as JSON for regression tracking.
+//
+//   ./RayTracingBenchmark [--models ../models] [--out benchmark.json]
+
+#include "BVH.hpp"
+#include "Material.hpp"
+#include "Triangle.hpp"
+#include <chrono>
+#include <fstream>
+#include <functional>
+
+namespace {
+
+// fastest of at least three runs of fn, repeated for at least minSeconds
+double measure(const std::function<void()> &fn, double minSeconds = 0.5)
+{
+    double best = std::numeric_limits<double>::infinity(), total = 0;
+    for (int run = 0; run < 3 || total < minSeconds; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+        total += elapsed.count();
+    }
+    return best;
+}
+
+struct Model {
+    std::string name;
+    std::vector<std::unique_ptr<MeshTriangle>> meshes;
+    std::vector<Object*> triangles;
+    Bounds3 bounds;
+};
+
+struct Result {
+    std::string group;
+    std::vector<std::pair<std::string, std::string>> labels;
+    std::string unit;
+    double value;
+};
+
+std::vector<Result> results;
+
+void report(const std::string &group,
+            std::vector<std::pair<std::string, std::string>> labels,
+            const std::string &unit, double value)
+{
+    std::cout << group;
+    for (auto &label : labels)
+        std::cout << " " << label.first << "=" << label.second;
+    std::cout << ": " << value << " " << unit << "\n";
+    results.push_back({group, std::move(labels), unit, value});
+}
+
+Model loadModel(const std::string &name, const std::vector<std::string> &files,
+                Material *m, Vector3f scale = Vector3f(1.0f))
+{
+    Model model;
+    model.name = name;
+    for (const std::string &file : files) {
+        auto mesh = std::make_unique<MeshTriangle>(file, m, Vector3f(0.0f), scale);
+        for (Triangle &tri : mesh->triangles)
+            model.triangles.push_back(&tri);
+        model.bounds = Union(model.bounds, mesh->getBounds());
+        model.meshes.push_back(std::move(mesh));
+    }
+    return model;
+}
+
+// a pinhole camera looking at the model from outside its bounds
+std::vector<Ray> primaryRays(const Bounds3 &bounds, int res)
+{
+    Vector3f center = bounds.Centroid();
+    Vector3f extent = bounds.Diagonal();
+    float radius = 0.5f * extent.norm();
+    Vector3f eye = center - Vector3f(0.0f, 0.0f, 2.5f * radius);
+    float scale = std::tan(0.5f * 40.0f * M_PI / 180.0f);
+
+    std::vector<Ray> rays;
+    for (int j = 0; j < res; ++j) {
+        for (int i = 0; i < res; ++i) {
+            float x = (2 * (i + 0.5f) / res - 1) * scale;
+            float y = (1 - 2 * (j + 0.5f) / res) * scale;
+            rays.emplace_back(eye, normalize(Vector3f(x, y, 1)));
+        }
+    }
+    return rays;
+}
+
+void benchmarkBuild(const Model &model)
+{
+    const std::pair<const char*, BVHAccel::SplitMethod> methods[] = {
+        {"naive", BVHAccel::SplitMethod::NAIVE},
+        {"sah", BVHAccel::SplitMethod::SAH}};
+    for (auto &method : methods) {
+        // rebuilds time the build alone, without the constructor's report
+        // and, since the node memory is kept, without its allocation
+        BVHAccel bvh(model.triangles, 1, method.second);
+        double seconds = measure([&]() { bvh.Rebuild(); }, 0.0);
+        report("bvh_build", {{"model", model.name}, {"split", method.first},
+               {"triangles", std::to_string(model.triangles.size())}},
+               "ms", seconds * 1e3);
+
+        seconds = measure([&]() { bvh.Refit(); });
+        report("bvh_refit", {{"model", model.name}, {"split", method.first},
+               {"triangles", std::to_string(model.triangles.size())}},
+               "ms", seconds * 1e3);
+    }
+}
+
+void benchmarkTraversal(const Model &model, BVHAccel::SplitMethod method,
+                        const char *methodName, std::mt19937 &rng)
+{
+    BVHAccel bvh(model.triangles, 1, method);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<Ray> primary = primaryRays(model.bounds, 512);
+
+    // hit points of the primary rays are the origins of the secondary rays
+    std::vector<Ray> diffuse, shadow;
+    Vector3f lightCenter = model.bounds.Centroid() +
+        Vector3f(0.0f, model.bounds.Diagonal().y, 0.0f);
+    for (const Ray &ray : primary) {
+        HitRecord hit;
+        if (!bvh.Intersect(ray, hit))
+            continue;
+        Intersection inter = hit.prim->getSurfaceInteraction(ray, hit);
+        Vector3f N = inter.normal;
+
+        // cosine-weighted direction around the normal
+        float r = std::sqrt(uniform(rng)), phi = 2 * M_PI * uniform(rng);
+        Vector3f local(r * std::cos(phi), r * std::sin(phi),
+                       std::sqrt(std::max(0.0f, 1.0f - r * r)));
+        Vector3f t = normalize(crossProduct(
+            std::fabs(N.x) > 0.9f ? Vector3f(0, 1, 0) : Vector3f(1, 0, 0), N));
+        Vector3f wi = local.x * t + local.y * crossProduct(N, t) + local.z * N;
+        diffuse.emplace_back(offsetRayOrigin(inter.coords, N, wi), wi);
+
+        // towards a small area light above the model
+        Vector3f target = lightCenter + 0.1f * model.bounds.Diagonal() *
+            Vector3f(uniform(rng) - 0.5f, 0.0f, uniform(rng) - 0.5f);
+        shadow.push_back(spawnRayTo(inter.coords, N, target, Vector3f(0, -1, 0)));
+    }
+
+    auto closestHit = [&](const std::vector<Ray> &rays, const char *kind) {
+        size_t hits = 0;
+        double seconds = measure([&]() {
+            hits = 0;
+            for (const Ray &ray : rays) {
+                HitRecord hit;
+                hits += bvh.Intersect(ray, hit);
+            }
+        });
+        report("traversal", {{"model", model.name}, {"split", methodName},
+               {"rays", kind}, {"hit_fraction", std::to_string(
+                   rays.empty() ? 0.0 : hits / double(rays.size()))}},
+               "Mrays/s", rays.size() / seconds * 1e-6);
+    };
+    closestHit(primary, "primary");
+    closestHit(diffuse, "diffuse");
+
+    // the primary rays again, as packets of neighbouring pixels in a row
+    {
+        std::vector<RayPacket> packets;
+        for (size_t i = 0; i < primary.size(); i += RayPacket::SIZE) {
+            RayPacket packet;
+            for (size_t k = 0; k < RayPacket::SIZE && i + k < primary.size(); ++k)
+                packet.set(k, primary[i + k]);
+            packets.push_back(packet);
+        }
+        size_t hits = 0;
+        double seconds = measure([&]() {
+            hits = 0;
+            for (const RayPacket &packet : packets) {
+                HitRecord records[RayPacket::SIZE];
+                bvh.IntersectPacket(packet, packet.active, records);
+                for (auto &record : records)
+                    hits += record.happened();
+            }
+        });
+        report("traversal", {{"model", model.name}, {"split", methodName},
+               {"rays", "primary_packet"}, {"hit_fraction",
+                   std::to_string(hits / double(primary.size()))}},
+               "Mrays/s", primary.size() / seconds * 1e-6);
+    }
+
+    size_t occluded = 0;
+    double seconds = measure([&]() {
+        occluded = 0;
+        for (const Ray &ray : shadow)
+            occluded += bvh.IntersectP(ray);
+    });
+    report("traversal", {{"model", model.name}, {"split", methodName},
+           {"rays", "shadow"}, {"hit_fraction", std::to_string(
+               shadow.empty() ? 0.0 : occluded / double(shadow.size()))}},
+           "Mrays/s", shadow.size() / seconds * 1e-6);
+}
+
+// every ray against every triangle of a small set, no traversal
+void benchmarkTriangle(const Model &model, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<Triangle*> triangles;
+    for (size_t i = 0; i < model.triangles.size() && triangles.size() < 64; i += 7)
+        triangles.push_back(static_cast<Triangle*>(model.triangles[i]));
+
+    // each ray is aimed at or just past one of the triangles
+    std::vector<Ray> rays;
+    Vector3f eye = model.bounds.Centroid() -
+        Vector3f(0.0f, 0.0f, model.bounds.Diagonal().norm());
+    for (int i = 0; i < 4096; ++i) {
+        Triangle *tri = triangles[i % triangles.size()];
+        float u = 1.4f * uniform(rng), v = 1.4f * uniform(rng) * (1.0f - 0.5f * u);
+        Vector3f target = tri->v0 + u * tri->e1 + v * tri->e2;
+        rays.emplace_back(eye, normalize(target - eye));
+    }
+
+    size_t hits = 0;
+    double seconds = measure([&]() {
+        hits = 0;
+        for (const Ray &ray : rays) {
+            // once per ray, as in a traversal
+            RayShear shear(ray.direction);
+            for (Triangle *tri : triangles) {
+                HitRecord hit;
+                hits += tri->intersect(ray, shear, hit);
+            }
+        }
+    });
+    double tests = double(rays.size()) * triangles.size();
+    report("triangle", {{"model", model.name},
+           {"hit_fraction", std::to_string(hits / tests)}},
+           "Mtests/s", tests / seconds * 1e-6);
+}
+
+void benchmarkMaterial(const char *name, Material &m, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    const int n = 1 << 16;
+    std::vector<Vector3f> wo(n), N(n), wi(n);
+    for (int i = 0; i < n; ++i) {
+        N[i] = normalize(Vector3f(uniform(rng), uniform(rng), uniform(rng)));
+        Vector3f w = normalize(Vector3f(uniform(rng), uniform(rng), uniform(rng)));
+        wo[i] = dotProduct(w, N[i]) < 0 ? -w : w;
+    }
+
+    double seconds = measure([&]() {
+        for (int i = 0; i < n; ++i)
+            wi[i] = m.sample(wo[i], N[i]);
+    });
+    report("material", {{"type", name}, {"op", "sample"}}, "Mops/s",
+           n / seconds * 1e-6);
+
+    float sum = 0;
+    seconds = measure([&]() {
+        for (int i = 0; i < n; ++i)
+            sum += m.pdf(wi[i], wo[i], N[i]);
+    });
+    report("material", {{"type", name}, {"op", "pdf"}}, "Mops/s",
+           n / seconds * 1e-6);
+
+    Vector3f f;
+    seconds = measure([&]() {
+        for (int i = 0; i < n; ++i)
+            f += m.eval(wi[i], wo[i], N[i]);
+    });
+    report("material", {{"type", name}, {"op", "eval"}}, "Mops/s",
+           n / seconds * 1e-6);
+
+    // keep the results alive
+    if (sum < 0 || f.x < 0)
+        std::cout << "";
+}
+
+std::string escape(const std::string &s)
+{
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+void writeJson(const std::string &path)
+{
+    std::ofstream out(path);
+    out << "{\n";
+#ifdef RAYTRACING_VECTOR_SSE
+    out << "  \"simd\": true,\n";
+#else
+    out << "  \"simd\": false,\n";
+#endif
+#if defined(RAYTRACING_PRECOMPUTED)
+    out << "  \"triangle_kernel\": \"precomputed\",\n";
+#elif defined(RAYTRACING_WATERTIGHT)
+    out << "  \"triangle_kernel\": \"watertight\",\n";
+#else
+    out << "  \"triangle_kernel\": \"moeller\",\n";
+#endif
+    out << "  \"packet_size\": " << RayPacket::SIZE << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        out << "    {\"benchmark\": \"" << r.group << "\"";
+        for (auto &label : r.labels)
+            out << ", \"" << label.first << "\": \"" << escape(label.second) << "\"";
+        out << ", \"unit\": \"" << r.unit << "\", \"value\": " << r.value << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+} // namespace
+
+const float EPSILON = 0.00001;
+
+int main(int argc, char** argv)
+{
+    std::string models = "../models";
+    std::string out = "benchmark.json";
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) == "--models") models = argv[++i];
+        else if (std::string(argv[i]) == "--out") out = argv[++i];
+    }
+
+    seed_random(1);
+    std::mt19937 rng(1);
+
+    Material white(DIFFUSE, Vector3f(0.0f));
+    white.Kd = Vector3f(0.725f, 0.71f, 0.68f);
+
+    Material mirror(MICROFACET, Vector3f(0.0f));
+    mirror.Kd = Vector3f(0.1914, 0.125, 0);
+    mirror.Ks = Vector3f(0.5977);
+    mirror.ior = 2.0f;
+    mirror.diffuseFactor = 0.;
+    mirror.roughness = 0.1;
+    mirror.f0 = Vector3f(1.00, 0.71, 0.29);
+    mirror.h_alpha = 0.0;
+    mirror.metallic = 0.8f;
+
+    Material copper = mirror;
+    copper.f0 = Vector3f(0.95, 0.64, 0.54);
+    copper.h_alpha = 0.2;
+
+    std::vector<Model> scenes;
+    scenes.push_back(loadModel("bunny", {models + "/bunny/bunny.obj"}, &white,
+                               Vector3f(2000.0f)));
+    scenes.push_back(loadModel("teapot", {models + "/teapot/teapot.obj"}, &white,
+                               Vector3f(30.0f)));
+    std::vector<std::string> box;
+    for (const char *part : {"floor", "shortbox", "tallbox", "left", "right", "light"})
+        box.push_back(models + "/cornellbox/" + part + ".obj");
+    scenes.push_back(loadModel("cornellbox", box, &white));
+
+    for (const Model &model : scenes) {
+        benchmarkBuild(model);
+        benchmarkTraversal(model, BVHAccel::SplitMethod::NAIVE, "naive", rng);
+        benchmarkTraversal(model, BVHAccel::SplitMethod::SAH, "sah", rng);
+        benchmarkTriangle(model, rng);
+    }
+    benchmarkMaterial("diffuse", white, rng);
+    benchmarkMaterial("microfacet_mirror", mirror, rng);
+    benchmarkMaterial("microfacet_rough", copper, rng);
+
+    writeJson(out);
+    std::cout << "Results written to " << out << "\n";
+
+    return 0;
+}
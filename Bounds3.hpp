@@ -5,6 +5,7 @@
 #ifndef RAYTRACING_BOUNDS3_H
 #define RAYTRACING_BOUNDS3_H
 #include "Ray.hpp"
+#include "RayPacket.hpp"
 #include "Vector.hpp"
 #include <limits>
 #include <array>
@@ -15,8 +16,8 @@ class Bounds3
     Vector3f pMin, pMax; // two points to specify the bounding box
     Bounds3()
     {
-        double minNum = std::numeric_limits<double>::lowest();
-        double maxNum = std::numeric_limits<double>::max();
+        float minNum = std::numeric_limits<float>::lowest();
+        float maxNum = std::numeric_limits<float>::max();
         pMax = Vector3f(minNum, minNum, minNum);
         pMin = Vector3f(maxNum, maxNum, maxNum);
     }
@@ -39,13 +40,13 @@ class Bounds3
             return 2;
     }
 
-    double SurfaceArea() const
+    float SurfaceArea() const
     {
         Vector3f d = Diagonal();
         return 2 * (d.x * d.y + d.x * d.z + d.y * d.z);
     }
 
-    Vector3f Centroid() { return 0.5 * pMin + 0.5 * pMax; }
+    Vector3f Centroid() const { return 0.5 * pMin + 0.5 * pMax; }
     Bounds3 Intersect(const Bounds3& b)
     {
         return Bounds3(Vector3f(fmax(pMin.x, b.pMin.x), fmax(pMin.y, b.pMin.y),
@@ -84,38 +85,49 @@ class Bounds3
         return (i == 0) ? pMin : pMax;
     }
 
-    inline bool IntersectP(const Ray& ray, const Vector3f& invDir,
-                           const std::array<int, 3>& dirisNeg) const;
+    // slab test against the part of the ray in (t_min, tMax), with tMax
+    // the closest hit found so far
+    inline bool IntersectP(const Ray& ray, float tMax) const;
+
+    // slab test of every lane of a packet against the box, skipping lanes
+    // whose closest hit so far (tMax) is in front of the box or whose
+    // interval (tmin, tMax) misses it; returns the number of lanes that hit
+    inline int IntersectP(const RayPacket& packet, const bool* active,
+                          const float* tMax, bool* hit) const;
 };
 
 
 
-inline bool Bounds3::IntersectP(const Ray& ray, const Vector3f& invDir,
-                                const std::array<int, 3>& dirIsNeg) const
+inline bool Bounds3::IntersectP(const Ray& ray, float tMax) const
 {
-    // invDir: ray direction(x,y,z), invDir=(1.0/x,1.0/y,1.0/z), use this because Multiply is faster that Division
-    // dirIsNeg: ray direction(x,y,z), dirIsNeg=[int(x>0),int(y>0),int(z>0)], use this to simplify your logic
-    // TODO test if ray bound intersects
-
-    Vector3f lower = (pMin - ray.origin) * invDir;
-    Vector3f upper = (pMax - ray.origin) * invDir;
+    Vector3f t0 = (pMin - ray.origin) * ray.direction_inv;
+    Vector3f t1 = (pMax - ray.origin) * ray.direction_inv;
 
-    if (dirIsNeg[0] > 0) {
-        std::swap(lower.x, upper.x);
-    }
+    // per-axis entry and exit distances, without branching on the signs
+    float lower_max = std::max(Vector3f::Min(t0, t1).maxComponent(), ray.t_min);
+    float upper_min = std::min(Vector3f::Max(t0, t1).minComponent(), tMax);
 
-    if (dirIsNeg[1] > 0) {
-        std::swap(lower.y, upper.y);
-    }
+    return upper_min >= lower_max;
+}
 
-    if (dirIsNeg[2] > 0) {
-        std::swap(lower.z, upper.z);
+inline int Bounds3::IntersectP(const RayPacket& p, const bool* active,
+                               const float* tMax, bool* hit) const
+{
+    int count = 0;
+    for (int i = 0; i < RayPacket::SIZE; ++i) {
+        float tx0 = (pMin.x - p.ox[i]) * p.ix[i], tx1 = (pMax.x - p.ox[i]) * p.ix[i];
+        float ty0 = (pMin.y - p.oy[i]) * p.iy[i], ty1 = (pMax.y - p.oy[i]) * p.iy[i];
+        float tz0 = (pMin.z - p.oz[i]) * p.iz[i], tz1 = (pMax.z - p.oz[i]) * p.iz[i];
+        // std::min/max rather than fmin/fmax so the loop maps onto SIMD min/max
+        float lower_max = std::max(std::min(tx0, tx1),
+            std::max(std::min(ty0, ty1), std::min(tz0, tz1)));
+        float upper_min = std::min(std::max(tx0, tx1),
+            std::min(std::max(ty0, ty1), std::max(tz0, tz1)));
+        hit[i] = active[i] & (std::min(upper_min, tMax[i]) >=
+                              std::max(lower_max, p.tmin[i]));
+        count += hit[i];
     }
-
-    float lower_max = fmax(lower.x, fmax(lower.y, lower.z));
-    float upper_min = fmin(upper.x, fmin(upper.y, upper.z));
-
-    return (upper_min >= lower_max) && (upper_min > 0);
+    return count;
 }
 
 inline Bounds3 Union(const Bounds3& b1, const Bounds3& b2)
@@ -126,6 +138,16 @@ inline Bounds3 Union(const Bounds3& b1, const Bounds3& b2)
     return ret;
 }
 
+// bounds at t between b1 (t = 0) and b2 (t = 1); conservative for anything
+// inside that moves linearly from b1 to b2
+inline Bounds3 Lerp(const Bounds3& b1, const Bounds3& b2, float t)
+{
+    Bounds3 ret;
+    ret.pMin = lerp(b1.pMin, b2.pMin, t);
+    ret.pMax = lerp(b1.pMax, b2.pMax, t);
+    return ret;
+}
+
 inline Bounds3 Union(const Bounds3& b, const Vector3f& p)
 {
     Bounds3 ret;
@@ -0,0 +1,85 @@
+#include "Camera.hpp"
+#include "global.hpp"
+
+inline float deg2rad(const float& deg) { return deg * M_PI / 180.0; }
+
+void Camera::setup(int w, int h)
+{
+    width = w;
+    height = h;
+    aspect = width / (float)height;
+    scale = tan(deg2rad(fov * 0.5));
+    forward = normalize(lookAt - eye);
+    // image x grows to the right of the view, as seen from eye
+    right = normalize(crossProduct(forward, up));
+    upDir = crossProduct(right, forward);
+}
+
+// Offset from the pixel center along one axis, distributed as the filter,
+// for u uniform in [0, 1). The filters are separable, so x and y are drawn
+// independently.
+float Camera::filterSample(float u) const
+{
+    switch (filter) {
+    case Filter::BOX:
+        return u - 0.5f;
+    case Filter::TENT:
+        // radius 1, inverse of the tent's CDF
+        return u < 0.5f ? std::sqrt(2 * u) - 1 : 1 - std::sqrt(2 - 2 * u);
+    case Filter::GAUSSIAN: {
+        // standard deviation 0.5, cut off at 1.5 pixels (Box-Muller); the
+        // rare rejected samples lose their stratum
+        float d;
+        do {
+            float r = std::sqrt(-2 * std::log(std::max(1.0f - u, 1e-7f)));
+            d = 0.5f * r * std::cos(2 * M_PI * get_random_float());
+            u = get_random_float();
+        } while (std::fabs(d) > 1.5f);
+        return d;
+    }
+    case Filter::NONE:
+    default:
+        return 0.0f;
+    }
+}
+
+Ray Camera::generateRay(int i, int j, float time) const
+{
+    if (filter == Filter::NONE)
+        return generateRay(i, j, time, Vector2f(0.5f));
+    float ux = get_random_float();
+    return generateRay(i, j, time, Vector2f(ux, get_random_float()));
+}
+
+Ray Camera::generateRay(int i, int j, float time, const Vector2f &u) const
+{
+    double px = i + 0.5, py = j + 0.5;
+    if (filter != Filter::NONE) {
+        px += filterSample(u.x);
+        py += filterSample(u.y);
+    }
+    float x = (2 * px / (float)width - 1) * aspect * scale;
+    float y = (1 - 2 * py / (float)height) * scale;
+    Vector3f dir = right * x + upDir * y + forward;
+
+    if (lensRadius <= 0)
+        return Ray(eye, normalize(dir), time);
+
+    // concentric mapping of the unit square onto the lens disk
+    float a = 2 * get_random_float() - 1, b = 2 * get_random_float() - 1;
+    float r = 0, theta = 0;
+    if (a != 0 || b != 0) {
+        if (std::fabs(a) > std::fabs(b)) {
+            r = a;
+            theta = M_PI / 4 * (b / a);
+        } else {
+            r = b;
+            theta = M_PI / 2 - M_PI / 4 * (a / b);
+        }
+    }
+    r *= lensRadius;
+    Vector3f origin = eye + right * (r * std::cos(theta)) + upDir * (r * std::sin(theta));
+    // dir has unit length along forward, so this is on the plane in focus
+    Vector3f focus = eye + dir * focusDistance;
+    return Ray(origin, normalize(focus - origin), time);
+}
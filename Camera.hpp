@@ -0,0 +1,49 @@
+#ifndef RAYTRACING_CAMERA_H
+#define RAYTRACING_CAMERA_H
+
+#include <string>
+#include "Ray.hpp"
+#include "Vector.hpp"
+
+// Pinhole or thin lens camera looking from eye towards lookAt. Without a
+// pixel filter and lens every sample of a pixel uses the ray through its
+// center; otherwise each sample draws a position in the pixel from the
+// filter (so plain averaging applies the filter) and a point on the lens.
+class Camera
+{
+public:
+    enum class Filter { NONE, BOX, TENT, GAUSSIAN };
+
+    std::string name = "default";
+    Vector3f eye = Vector3f(278, 273, -800);
+    Vector3f lookAt = Vector3f(278, 273, 0);
+    Vector3f up = Vector3f(0, 1, 0);
+    // vertical field of view in degrees
+    double fov = 40;
+    // thin lens: no depth of field while lensRadius is 0
+    float lensRadius = 0;
+    float focusDistance = 800;
+    Filter filter = Filter::NONE;
+
+    // the basis and image plane for a width x height image, to be called
+    // after changing any of the above
+    void setup(int width, int height);
+
+    // whether samples of a pixel get different rays
+    bool jittered() const { return filter != Filter::NONE || lensRadius > 0; }
+
+    // a camera ray through pixel (i, j) at shutter time
+    Ray generateRay(int i, int j, float time) const;
+    // the same with the filter's position in the pixel drawn from u in
+    // [0, 1)^2 instead of random numbers, for stratified samples
+    Ray generateRay(int i, int j, float time, const Vector2f &u) const;
+
+private:
+    float filterSample(float u) const;
+
+    Vector3f right, upDir, forward;
+    float scale = 1, aspect = 1;
+    int width = 1, height = 1;
+};
+
+#endif //RAYTRACING_CAMERA_H
@@ -0,0 +1,99 @@
+#include "Image.hpp"
+#include "global.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+bool writePFM(const std::string &path, int width, int height,
+              const std::vector<Vector3f> &pixels)
+{
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+        return false;
+    // a negative scale marks little endian data
+    fprintf(fp, "PF\n%d %d\n-1.0\n", width, height);
+    // PFM rows go from the bottom of the image to the top
+    std::vector<float> row(3 * width);
+    for (int j = height - 1; j >= 0; --j) {
+        for (int i = 0; i < width; ++i) {
+            const Vector3f &p = pixels[j * width + i];
+            row[3 * i] = p.x;
+            row[3 * i + 1] = p.y;
+            row[3 * i + 2] = p.z;
+        }
+        fwrite(row.data(), sizeof(float), row.size(), fp);
+    }
+    return fclose(fp) == 0;
+}
+
+bool readPFM(const std::string &path, int &width, int &height,
+             std::vector<Vector3f> &pixels)
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return false;
+    char magic[3] = {};
+    float scale;
+    if (fscanf(fp, "%2s %d %d %f", magic, &width, &height, &scale) != 4 ||
+        std::strcmp(magic, "PF") != 0 || scale >= 0 || width <= 0 || height <= 0) {
+        fclose(fp);
+        return false;
+    }
+    fgetc(fp); // the single whitespace before the data
+
+    pixels.assign(width * height, Vector3f(0.0f));
+    std::vector<float> row(3 * width);
+    for (int j = height - 1; j >= 0; --j) {
+        if (fread(row.data(), sizeof(float), row.size(), fp) != row.size()) {
+            fclose(fp);
+            return false;
+        }
+        for (int i = 0; i < width; ++i)
+            pixels[j * width + i] = Vector3f(row[3 * i], row[3 * i + 1], row[3 * i + 2]);
+    }
+    fclose(fp);
+    return true;
+}
+
+bool writePPM(const std::string &path, int width, int height,
+              const std::vector<Vector3f> &pixels)
+{
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+        return false;
+    fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> row(3 * width);
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            const Vector3f &p = pixels[j * width + i];
+            for (int c = 0; c < 3; ++c) {
+                // pixels that are black up to rounding stay exactly black
+                float v = p.norm() > EPSILON ? clamp(0, 1, p[c]) : 0.0f;
+                row[3 * i + c] = (unsigned char)(255 * std::pow(v, 0.6f));
+            }
+        }
+        fwrite(row.data(), 1, row.size(), fp);
+    }
+    return fclose(fp) == 0;
+}
+
+ImageError compareImages(const std::vector<Vector3f> &image,
+                         const std::vector<Vector3f> &reference)
+{
+    ImageError error;
+    if (image.empty() || image.size() != reference.size())
+        return error;
+    double se = 0, relSE = 0;
+    for (size_t i = 0; i < image.size(); ++i) {
+        for (int c = 0; c < 3; ++c) {
+            double d = image[i][c] - reference[i][c];
+            double r = reference[i][c];
+            se += d * d;
+            relSE += d * d / (r * r + 0.01);
+        }
+    }
+    size_t n = 3 * image.size();
+    error.rmse = std::sqrt(se / n);
+    error.relMSE = relSE / n;
+    return error;
+}
@@ -0,0 +1,33 @@
+#ifndef RAYTRACING_IMAGE_H
+#define RAYTRACING_IMAGE_H
+
+#include <limits>
+#include <string>
+#include <vector>
+#include "Vector.hpp"
+
+// Float images in the PFM format (three channels, little endian), so that
+// renders can be compared without the tone mapping and 8-bit rounding of
+// the PPM output. Pixels are stored row by row from the top.
+bool writePFM(const std::string &path, int width, int height,
+              const std::vector<Vector3f> &pixels);
+bool readPFM(const std::string &path, int &width, int &height,
+             std::vector<Vector3f> &pixels);
+// 8-bit PPM of the pixels clamped to [0, 1], with gamma 1/0.6
+bool writePPM(const std::string &path, int width, int height,
+              const std::vector<Vector3f> &pixels);
+
+// Error of an image against a reference of the same size, over all pixels
+// and channels. relMSE divides each squared error by the squared reference
+// value (plus 0.01, so that black pixels do not dominate). Both are NaN if
+// the image is empty or the sizes differ, which fails any comparison with
+// a threshold.
+struct ImageError {
+    double rmse = std::numeric_limits<double>::quiet_NaN();
+    double relMSE = std::numeric_limits<double>::quiet_NaN();
+};
+
+ImageError compareImages(const std::vector<Vector3f> &image,
+                         const std::vector<Vector3f> &reference);
+
+#endif //RAYTRACING_IMAGE_H
@@ -15,7 +15,7 @@ struct Intersection
         happened=false;
         coords=Vector3f();
         normal=Vector3f();
-        distance= std::numeric_limits<double>::max();
+        distance= std::numeric_limits<float>::max();
         obj =nullptr;
         m=nullptr;
     }
@@ -24,8 +24,20 @@ struct Intersection
     Vector3f tcoords;
     Vector3f normal;
     Vector3f emit;
-    double distance;
+    float distance;
     Object* obj;
     Material* m;
 };
+
+// What traversal keeps for the closest hit found so far: the distance, the
+// barycentric coordinates and the primitive. The full Intersection is only
+// computed for the final hit by Object::getSurfaceInteraction.
+struct HitRecord
+{
+    float t = std::numeric_limits<float>::max();
+    float u = 0, v = 0;
+    Object* prim = nullptr;
+
+    bool happened() const { return prim != nullptr; }
+};
 #endif //RAYTRACING_INTERSECTION_H
@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <numeric>
+#include "LightBVH.hpp"
+
+static inline float safeAcos(float x) { return std::acos(clamp(-1, 1, x)); }
+
+// rotate v around the unit axis k by angle (Rodrigues' formula)
+static Vector3f rotate(const Vector3f &v, const Vector3f &k, float angle)
+{
+    float c = std::cos(angle), s = std::sin(angle);
+    return v * c + crossProduct(k, v) * s + k * (dotProduct(k, v) * (1 - c));
+}
+
+static LightCone Union(LightCone a, LightCone b)
+{
+    if (b.thetaO > a.thetaO) std::swap(a, b);
+    LightCone ret;
+    ret.thetaE = std::max(a.thetaE, b.thetaE);
+    float thetaD = safeAcos(dotProduct(a.axis, b.axis));
+    if (std::min(thetaD + b.thetaO, float(M_PI)) <= a.thetaO) {
+        ret.axis = a.axis;
+        ret.thetaO = a.thetaO;
+        return ret;
+    }
+    float thetaO = (a.thetaO + thetaD + b.thetaO) / 2;
+    if (thetaO >= M_PI) {
+        ret.axis = a.axis;
+        ret.thetaO = M_PI;
+        return ret;
+    }
+    // rotate a's axis towards b's so that the new cone just covers both
+    Vector3f k = crossProduct(a.axis, b.axis);
+    if (k.norm() < EPSILON) {
+        // opposite axes, any perpendicular rotation axis works
+        k = crossProduct(a.axis, std::fabs(a.axis.x) > 0.9f ?
+            Vector3f(0, 1, 0) : Vector3f(1, 0, 0));
+    }
+    ret.axis = normalize(rotate(a.axis, normalize(k), thetaO - a.thetaO));
+    ret.thetaO = thetaO;
+    return ret;
+}
+
+void LightBVH::build(const std::vector<Object*> &emitters,
+                     const std::vector<float> &power)
+{
+    lights = emitters;
+    lightPower = power;
+    nodes.clear();
+    trails.assign(lights.size(), 0);
+    depths.assign(lights.size(), 0);
+    if (lights.empty())
+        return;
+
+    std::vector<int> ids(lights.size());
+    std::iota(ids.begin(), ids.end(), 0);
+    nodes.reserve(2 * lights.size());
+    recursiveBuild(ids, 0, ids.size(), 0, 0);
+}
+
+int LightBVH::recursiveBuild(std::vector<int> &ids, int begin, int end,
+                             uint64_t trail, int depth)
+{
+    int index = nodes.size();
+    nodes.emplace_back();
+
+    if (end - begin == 1) {
+        int id = ids[begin];
+        LightBVHNode &leaf = nodes[index];
+        leaf.bounds = lights[id]->getBounds();
+        leaf.cone.thetaO = lights[id]->getNormalCone(leaf.cone.axis);
+        leaf.power = lightPower[id];
+        leaf.left = id;
+        trails[id] = trail;
+        depths[id] = depth;
+        return index;
+    }
+
+    // split at the median centroid along the widest axis, like BVHAccel
+    Bounds3 centroidBounds;
+    for (int i = begin; i < end; ++i)
+        centroidBounds = Union(centroidBounds,
+                               lights[ids[i]]->getBounds().Centroid());
+    int dim = centroidBounds.maxExtent();
+    int mid = (begin + end) / 2;
+    std::nth_element(ids.begin() + begin, ids.begin() + mid, ids.begin() + end,
+        [&](int a, int b) {
+            const Vector3f ca = lights[a]->getBounds().Centroid();
+            const Vector3f cb = lights[b]->getBounds().Centroid();
+            return ca[dim] < cb[dim];
+        });
+
+    int left = recursiveBuild(ids, begin, mid, trail, depth + 1);
+    int right = recursiveBuild(ids, mid, end, trail | (uint64_t(1) << depth),
+                               depth + 1);
+
+    LightBVHNode &node = nodes[index];
+    node.left = left;
+    node.right = right;
+    node.bounds = Union(nodes[left].bounds, nodes[right].bounds);
+    node.cone = Union(nodes[left].cone, nodes[right].cone);
+    node.power = nodes[left].power + nodes[right].power;
+    return index;
+}
+
+float LightBVH::importance(const LightBVHNode &node, const Vector3f &p,
+                           const Vector3f &n) const
+{
+    if (node.power <= 0)
+        return 0.0f;
+
+    Vector3f c = 0.5 * node.bounds.pMin + 0.5 * node.bounds.pMax;
+    Vector3f d = c - p;
+    float radius = 0.5f * node.bounds.Diagonal().norm();
+    // keep the estimate finite for shading points close to the cluster
+    float dist2 = std::max(dotProduct(d, d), radius * radius);
+    float dist = std::sqrt(dist2);
+    Vector3f wi = d / dist;
+
+    // angle subtended by the bounding sphere of the node
+    float thetaU = dist > radius ? std::asin(radius / dist) : M_PI;
+
+    // angle between the emission cone and the direction to p
+    float theta = safeAcos(dotProduct(node.cone.axis, -wi));
+    float thetaP = std::max(0.0f, theta - node.cone.thetaO - thetaU);
+    if (thetaP >= node.cone.thetaE)
+        return 0.0f;
+
+    float cosI = 1.0f;
+    if (n.x != 0 || n.y != 0 || n.z != 0) {
+        float thetaI = safeAcos(dotProduct(n, wi));
+        thetaI = std::max(0.0f, thetaI - thetaU);
+        if (thetaI >= M_PI / 2)
+            return 0.0f;
+        cosI = std::cos(thetaI);
+    }
+
+    return node.power * cosI * std::cos(thetaP) / dist2;
+}
+
+int LightBVH::sample(const Vector3f &p, const Vector3f &n, float u,
+                     float &pmf) const
+{
+    pmf = 0.0f;
+    if (nodes.empty())
+        return -1;
+
+    float prob = 1.0f;
+    int index = 0;
+    while (!nodes[index].isLeaf()) {
+        const LightBVHNode &node = nodes[index];
+        float wl = importance(nodes[node.left], p, n);
+        float wr = importance(nodes[node.right], p, n);
+        if (wl + wr <= 0)
+            return -1;
+        float pl = wl / (wl + wr);
+        // reuse u for the next level after remapping it to [0, 1)
+        if (u < pl) {
+            index = node.left;
+            u = std::min(u / pl, 0.99999994f);
+            prob *= pl;
+        } else {
+            index = node.right;
+            u = std::min((u - pl) / (1 - pl), 0.99999994f);
+            prob *= 1 - pl;
+        }
+    }
+    pmf = prob;
+    return nodes[index].left;
+}
+
+float LightBVH::pmf(const Vector3f &p, const Vector3f &n, int emitter) const
+{
+    if (nodes.empty() || emitter < 0 || emitter >= lights.size())
+        return 0.0f;
+
+    float prob = 1.0f;
+    int index = 0;
+    for (int level = 0; level < depths[emitter]; ++level) {
+        const LightBVHNode &node = nodes[index];
+        float wl = importance(nodes[node.left], p, n);
+        float wr = importance(nodes[node.right], p, n);
+        if (wl + wr <= 0)
+            return 0.0f;
+        bool goRight = (trails[emitter] >> level) & 1;
+        prob *= (goRight ? wr : wl) / (wl + wr);
+        index = goRight ? node.right : node.left;
+    }
+    return prob;
+}
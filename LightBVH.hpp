@@ -0,0 +1,58 @@
+#ifndef RAYTRACING_LIGHTBVH_H
+#define RAYTRACING_LIGHTBVH_H
+
+#include <vector>
+#include <cstdint>
+#include "Object.hpp"
+#include "Bounds3.hpp"
+#include "Intersection.hpp"
+#include "Vector.hpp"
+
+// Bound on the emission directions of a set of lights: all normals lie
+// within thetaO of axis, and each emits up to thetaE away from its normal
+struct LightCone {
+    Vector3f axis = Vector3f(0, 0, 1);
+    float thetaO = M_PI;
+    float thetaE = M_PI / 2;
+};
+
+struct LightBVHNode {
+    Bounds3 bounds;
+    LightCone cone;
+    float power = 0;
+    // interior nodes: child indices, leaves: emitter index in left
+    int left = -1, right = -1;
+    bool isLeaf() const { return right < 0; }
+};
+
+// Light hierarchy for many-light sampling (Conty Estevez and Kulla 2018).
+// Each node bounds the position, orientation and power of its emitters, and
+// a shading point descends the tree choosing children proportionally to an
+// estimate of the light they can contribute.
+class LightBVH {
+public:
+    // emitters and their power, indices are shared with Scene::emitters
+    void build(const std::vector<Object*> &emitters, const std::vector<float> &power);
+    bool empty() const { return nodes.empty(); }
+
+    // choose an emitter for shading point p with normal n; pass a zero
+    // normal for points without a surface, returns -1 if nothing is lit
+    int sample(const Vector3f &p, const Vector3f &n, float u, float &pmf) const;
+    // probability of sample choosing emitter from p
+    float pmf(const Vector3f &p, const Vector3f &n, int emitter) const;
+
+private:
+    int recursiveBuild(std::vector<int> &ids, int begin, int end,
+                       uint64_t trail, int depth);
+    float importance(const LightBVHNode &node, const Vector3f &p,
+                     const Vector3f &n) const;
+
+    std::vector<Object*> lights;
+    std::vector<float> lightPower;
+    std::vector<LightBVHNode> nodes;
+    // root-to-leaf path of every emitter, one bit per level (1 = right)
+    std::vector<uint64_t> trails;
+    std::vector<int> depths;
+};
+
+#endif //RAYTRACING_LIGHTBVH_H
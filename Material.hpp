@@ -99,6 +99,60 @@ private:
         return Vector3f(dotProduct(a, B), dotProduct(a, C), dotProduct(a, N));
     }
 
+    // GGX roughness, clamped so that a perfect mirror (h_alpha = 0) does
+    // not turn D into a delta distribution
+    float ggxAlpha() const { return std::max(h_alpha, 1e-3f); }
+
+    // GGX normal distribution for a half vector h in the local frame
+    float ggxD(const Vector3f &h) const
+    {
+        if (h.z <= 0.0f) return 0.0f;
+        float alpha2 = ggxAlpha() * ggxAlpha();
+        float t = h.z * h.z * (alpha2 - 1) + 1;
+        return alpha2 / (M_PI * t * t);
+    }
+
+    // Smith Lambda function of GGX for a direction w in the local frame
+    float smithLambda(const Vector3f &w) const
+    {
+        float cos2 = w.z * w.z;
+        if (cos2 <= 0.0f) return 0.0f;
+        float tan2 = std::max(0.0f, 1.0f - cos2) / cos2;
+        float alpha2 = ggxAlpha() * ggxAlpha();
+        return 0.5f * (std::sqrt(1.0f + alpha2 * tan2) - 1.0f);
+    }
+
+    float smithG1(const Vector3f &w) const { return 1.0f / (1.0f + smithLambda(w)); }
+
+    // height-correlated masking-shadowing
+    float smithG2(const Vector3f &wi, const Vector3f &wo) const
+    {
+        return 1.0f / (1.0f + smithLambda(wi) + smithLambda(wo));
+    }
+
+    // Sample a visible normal of GGX as seen from v, in the local frame
+    // (Heitz 2018, "Sampling the GGX Distribution of Visible Normals")
+    Vector3f sampleGGXVNDF(const Vector3f &v, float x_1, float x_2) const
+    {
+        float alpha = ggxAlpha();
+        // stretch the view vector to the hemisphere configuration
+        Vector3f vh = normalize(Vector3f(alpha * v.x, alpha * v.y, v.z));
+        float lensq = vh.x * vh.x + vh.y * vh.y;
+        Vector3f t1 = lensq > 0 ? Vector3f(-vh.y, vh.x, 0) / std::sqrt(lensq)
+                                : Vector3f(1, 0, 0);
+        Vector3f t2 = crossProduct(vh, t1);
+        // uniform sample on the projected disk
+        float r = std::sqrt(x_1), phi = 2 * M_PI * x_2;
+        float p1 = r * std::cos(phi), p2 = r * std::sin(phi);
+        float s = 0.5f * (1.0f + vh.z);
+        p2 = (1.0f - s) * std::sqrt(std::max(0.0f, 1.0f - p1 * p1)) + s * p2;
+        Vector3f nh = p1 * t1 + p2 * t2 +
+            std::sqrt(std::max(0.0f, 1.0f - p1 * p1 - p2 * p2)) * vh;
+        // unstretch back to the ellipsoid configuration
+        return normalize(Vector3f(alpha * nh.x, alpha * nh.y,
+            std::max(0.0f, nh.z)));
+    }
+
 public:
     MaterialType m_type;
     //Vector3f m_color;
@@ -152,21 +206,22 @@ Vector3f Material::sample(const Vector3f &wi, const Vector3f &N){
     switch(m_type){
         case MICROFACET:
         {
+            // sample a half vector from the visible normals and reflect the
+            // view direction about it
+            Vector3f v = toLocal(wi, N);
+            if (v.z <= 0.0f) return reflect(-wi, N);
             float x_1 = get_random_float(), x_2 = get_random_float();
-            float theta_m = acos(sqrt((1 - x_1)/(x_1*(h_alpha*h_alpha - 1)+1)));
-            float phi = 2*M_PI*x_2;
-            Vector3f h = Vector3f(sin(theta_m)*sin(phi), sin(theta_m)*cos(phi), 
-                cos(theta_m));
-            Vector3f world_h = normalize(toWorld(h, N));
-            return 2*dotProduct(world_h, wi)*world_h - wi;
+            Vector3f h = sampleGGXVNDF(v, x_1, x_2);
+            return toWorld(2*dotProduct(h, v)*h - v, N);
             break;
         }
         case DIFFUSE:
         {
-            // uniform sample on the hemisphere
+            // cosine-weighted sample on the hemisphere (Malley's method):
+            // sample the unit disk uniformly and project up onto the hemisphere
             float x_1 = get_random_float(), x_2 = get_random_float();
-            float z = std::fabs(1.0f - 2.0f * x_1);
-            float r = std::sqrt(1.0f - z * z), phi = 2 * M_PI * x_2;
+            float r = std::sqrt(x_1), phi = 2 * M_PI * x_2;
+            float z = std::sqrt(std::max(0.0f, 1.0f - x_1));
             Vector3f localRay(r*std::cos(phi), r*std::sin(phi), z);
             return toWorld(localRay, N);
             
@@ -177,18 +232,22 @@ Vector3f Material::sample(const Vector3f &wi, const Vector3f &N){
 
 float Material::pdf(const Vector3f &wi, const Vector3f &wo, const Vector3f &N){
     switch(m_type){
-        case MICROFACET: 
+        case MICROFACET:
         {
-            Vector3f h = normalize(wo+wi);
-
-            return fabs(dotProduct(h, N))/fmax(4*fabs(dotProduct(h, wo)), EPSILON);
+            // VNDF pdf G1(wo) * D(h) / (4 * cos(wo)), the 1 / (4 * |h.wo|)
+            // Jacobian of the reflection cancels the visible normal weight
+            Vector3f v = toLocal(wo, N), l = toLocal(wi, N);
+            if (v.z <= 0.0f || l.z <= 0.0f) return 0.0f;
+            Vector3f h = normalize(v + l);
+            return smithG1(v) * ggxD(h) / (4 * v.z);
             break;
         }
         case DIFFUSE:
         {
-            // uniform sample probability 1 / (2 * PI)
-            if (dotProduct(wo, N) > 0.0f)
-                return 0.5f / M_PI;
+            // cosine-weighted sample probability cos(theta) / PI
+            float cosTheta = dotProduct(wi, N);
+            if (dotProduct(wo, N) > 0.0f && cosTheta > 0.0f)
+                return cosTheta / M_PI;
             else
                 return 0.0f;
             break;
@@ -212,61 +271,16 @@ Vector3f Material::eval(const Vector3f &wi, const Vector3f &wo, const Vector3f &
         }
         case MICROFACET:
         {
-            float cosalpha_i = fabs(dotProduct(N, wi));
-            float cosalpha = fabs(dotProduct(N, wo));
-            float d = diffuseFactor;
-    
-
-            if (dotProduct(N, wo) > EPSILON && dotProduct(N, wi) > EPSILON) {
-                Vector3f h = normalize(wi + wo);
-
-                float cosalpha_h = fabs(dotProduct(N, h));
-
-                // Blinn-Phong normal density
-
-                // float roughness = 0.2;
-                // float alpha = roughness * roughness;
-                
-                // double D = (1/(M_PI * alpha * alpha)) * pow(dotProduct(h, N), 
-                //     (2/(alpha*alpha) - 2));
-
-                // Beckman normal density
-                // float m = roughness;
-                // double D = (1/(m*m*pow(cosalpha_h,4)))*exp((cosalpha_h*cosalpha_h - 1)/(pow(m*cosalpha_h,2)));
-
-                // GGX normal density
-                float alpha = h_alpha;
-                double D = alpha*alpha/(M_PI*pow(
-                    cosalpha_h*cosalpha_h*(alpha*alpha - 1)+1, 2));
-
-                // float G = fmin(1, fmin((2*cosalpha_h*
-                //     cosalpha)/dotProduct(wo, h),(2*cosalpha_h*
-                //     cosalpha_i)/dotProduct(wo, h)));
-
-                //Schlick-GGX geometry function
-                float k_direct = pow(alpha+1,2)/8;
-                float k_ibl = pow(alpha,2)/2;
-
-                float k = k_direct;
-                float G =  ((cosalpha_i/(cosalpha_i*(1 - k) + k)) *
-                         (cosalpha/(cosalpha*(1 - k) + k)));
-
-                // float G = (2*cosalpha_i*cosalpha)/(
-                //     cosalpha*sqrt(alpha*alpha+(1 - alpha*alpha)*cosalpha_i*cosalpha_i)+
-                //     cosalpha_i*sqrt(alpha*alpha+(1 - alpha*alpha)*cosalpha*cosalpha));
-
-                Vector3f F = f0 + (Vector3f(1) - f0)*(1 - pow(dotProduct(h, wi),5));
-
-                // float F = kr;
-
-
-
-                // std::cout << kr << std::endl;
-                // std::cout << D << " " << G << " " << F << std::endl;
-                //                     ((D*G*F)/(4*dotProduct(N, wi)*dotProduct(N, wo))) 
-                // Kd = Vector3f(0.1914,0.125,0);
-                // Ks = Vector3f(0.5977);
-                return ((G*F)/fmax(4*cosalpha_i*cosalpha, EPSILON));
+            // Cook-Torrance with GGX D, height-correlated Smith G and
+            // Schlick's Fresnel approximation
+            Vector3f v = toLocal(wo, N), l = toLocal(wi, N);
+            if (v.z > EPSILON && l.z > EPSILON) {
+                Vector3f h = normalize(v + l);
+                float D = ggxD(h);
+                float G = smithG2(l, v);
+                Vector3f F = f0 + (Vector3f(1) - f0) *
+                    std::pow(1 - clamp(0, 1, dotProduct(h, l)), 5);
+                return (D*G*F)/(4*l.z*v.z);
             } else {
                 return Vector3f(0.0f);
             }
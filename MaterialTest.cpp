@@ -0,0 +1,126 @@
+// Statistical checks of the DIFFUSE material's estimator, run by ctest:
+// for several normals, the mean of eval * cos / pdf over directions drawn
+// from sample must be Kd, the sampled cosines must be distributed as
+// cos / PI, pdf must integrate to one over the hemisphere and be zero
+// below it. Exits nonzero if any check fails.
+//
+//   ./MaterialTest [samples]
+
+#include "global.hpp"
+#include "Material.hpp"
+#include <cstdlib>
+
+const float EPSILON = 0.00001;
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string &what, const Vector3f &N, double value,
+           double expected)
+{
+    if (ok)
+        return;
+    ++failures;
+    std::cerr << "FAILED " << what << " for N = " << N << ": " << value
+              << ", expected " << expected << "\n";
+}
+
+// a unit vector perpendicular to N
+Vector3f perpendicular(const Vector3f &N)
+{
+    Vector3f axis = std::fabs(N.x) < 0.9f ? Vector3f(1, 0, 0) : Vector3f(0, 1, 0);
+    return normalize(crossProduct(N, axis));
+}
+
+// uniform on the unit sphere
+Vector3f uniformSphere()
+{
+    float z = 1.0f - 2.0f * get_random_float();
+    float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+    float phi = 2 * M_PI * get_random_float();
+    return Vector3f(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+void testDiffuse(const Vector3f &N, int samples)
+{
+    Material m(DIFFUSE);
+    m.Kd = Vector3f(0.725f, 0.71f, 0.68f);
+    // viewed at an angle, so that wo is not the normal itself
+    Vector3f wo = normalize(N + 0.75f * perpendicular(N));
+
+    // estimator of the reflected radiance under unit incident radiance
+    double sum[3] = {0, 0, 0}, cosSum = 0;
+    bool belowSampled = false;
+    for (int k = 0; k < samples; ++k) {
+        Vector3f wi = normalize(m.sample(wo, N));
+        float cosTheta = dotProduct(wi, N);
+        float pdf = m.pdf(wi, wo, N);
+        if (cosTheta < 0.0f)
+            belowSampled = true;
+        cosSum += cosTheta;
+        if (pdf <= 0.0f)
+            continue;
+        Vector3f f = m.eval(wi, wo, N) * cosTheta / pdf;
+        sum[0] += f.x;
+        sum[1] += f.y;
+        sum[2] += f.z;
+    }
+    for (int c = 0; c < 3; ++c) {
+        double mean = sum[c] / samples;
+        check(std::fabs(mean - m.Kd[c]) < 0.01, "mean of eval * cos / pdf", N,
+              mean, m.Kd[c]);
+    }
+    check(!belowSampled, "sample below the hemisphere", N, 1, 0);
+    // E[cos] = 2/3 under the density cos / PI
+    double meanCos = cosSum / samples;
+    check(std::fabs(meanCos - 2.0 / 3.0) < 0.005, "mean cosine of samples", N,
+          meanCos, 2.0 / 3.0);
+
+    // pdf integrates to one over the hemisphere, estimated with uniform
+    // directions of density 1 / (2 PI), and is zero for all below it
+    double integral = 0;
+    float maxBelow = 0;
+    for (int k = 0; k < samples; ++k) {
+        Vector3f d = uniformSphere();
+        if (dotProduct(d, N) < 0.0f)
+            d = -d;
+        integral += m.pdf(d, wo, N) * 2 * M_PI;
+        maxBelow = std::max(maxBelow, m.pdf(-d, wo, N));
+    }
+    integral /= samples;
+    check(std::fabs(integral - 1.0) < 0.01, "integral of pdf", N, integral, 1);
+    check(maxBelow == 0.0f, "pdf below the hemisphere", N, maxBelow, 0);
+    // nor is anything sampled for a viewer below the surface
+    check(m.pdf(N, -wo, N) == 0.0f, "pdf with wo below the hemisphere", N,
+          m.pdf(N, -wo, N), 0);
+
+    std::cout << "N = " << N << ": mean " << sum[0] / samples << " "
+              << sum[1] / samples << " " << sum[2] / samples
+              << ", mean cosine " << meanCos << ", pdf integral " << integral
+              << "\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int samples = argc > 1 ? std::atoi(argv[1]) : 200000;
+    seed_random(1);
+
+    const Vector3f normals[] = {
+        Vector3f(0, 0, 1), Vector3f(0, 0, -1), Vector3f(1, 0, 0),
+        Vector3f(0, -1, 0), normalize(Vector3f(1, 2, 3)),
+        normalize(Vector3f(-0.3f, 0.05f, -0.9f)),
+        // |x| close to |y|, where toWorld switches tangent frames
+        normalize(Vector3f(0.7f, 0.7001f, 0.1f)),
+    };
+    for (const Vector3f &N : normals)
+        testDiffuse(N, samples);
+
+    if (failures) {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+#ifndef RAYTRACING_MEMORYARENA_H
+#define RAYTRACING_MEMORYARENA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Monotonic allocator: objects are carved out of large cache line aligned
+// blocks in allocation order and are only ever freed all at once, when the
+// arena is reset or destroyed. Rewinding instead keeps the blocks and hands
+// them out again, for an arena refilled over and over. Destructors are not run, so only trivially
+// destructible types may be allocated. The bytes held by all arenas are
+// tracked, so that the peak can be reported after rendering.
+class MemoryArena {
+public:
+    explicit MemoryArena(size_t blockSize = 256 * 1024) : blockSize(blockSize) {}
+    ~MemoryArena() { Reset(); }
+    MemoryArena(const MemoryArena&) = delete;
+    MemoryArena& operator=(const MemoryArena&) = delete;
+
+    void* Alloc(size_t bytes, size_t align = alignof(std::max_align_t))
+    {
+        size_t offset = (currentPos + align - 1) & ~(align - 1);
+        if (used == 0 || offset + bytes > blocks[used - 1].size) {
+            // the next block kept by Rewind if it is large enough, else a
+            // new one; oversized requests get a block of their own
+            if (used == blocks.size() || blocks[used].size < bytes) {
+                size_t size = std::max(bytes, blockSize);
+                blocks.insert(blocks.begin() + used, {static_cast<uint8_t*>(
+                    ::operator new(size, std::align_val_t(BLOCK_ALIGN))), size});
+                addBytes(size);
+            }
+            ++used;
+            offset = 0;
+        }
+        currentPos = offset + bytes;
+        return blocks[used - 1].data + offset;
+    }
+
+    // n default constructed T
+    template <typename T>
+    T* Alloc(size_t n = 1)
+    {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "arena objects are never destroyed");
+        static_assert(alignof(T) <= BLOCK_ALIGN, "over-aligned type");
+        T* ret = static_cast<T*>(Alloc(n * sizeof(T), alignof(T)));
+        for (size_t i = 0; i < n; ++i)
+            new (&ret[i]) T();
+        return ret;
+    }
+
+    // frees everything allocated so far
+    void Reset()
+    {
+        for (const Block& block : blocks) {
+            ::operator delete(block.data, std::align_val_t(BLOCK_ALIGN));
+            liveBytes -= block.size;
+        }
+        blocks.clear();
+        used = 0;
+        currentPos = 0;
+    }
+
+    // forgets everything allocated so far but keeps the blocks for reuse
+    void Rewind()
+    {
+        used = 0;
+        currentPos = 0;
+    }
+
+    size_t TotalAllocated() const
+    {
+        size_t total = 0;
+        for (const Block& block : blocks)
+            total += block.size;
+        return total;
+    }
+
+    // largest number of bytes held by all arenas together at any time
+    static size_t PeakBytes() { return peakBytes; }
+
+private:
+    static const size_t BLOCK_ALIGN = 64;
+
+    struct Block {
+        uint8_t* data;
+        size_t size;
+    };
+
+    static void addBytes(size_t bytes)
+    {
+        size_t live = liveBytes += bytes;
+        size_t peak = peakBytes;
+        while (live > peak && !peakBytes.compare_exchange_weak(peak, live)) {}
+    }
+
+    const size_t blockSize;
+    size_t currentPos = 0;
+    // blocks[0, used) have been allocated from, the last one is current
+    size_t used = 0;
+    std::vector<Block> blocks;
+
+    static inline std::atomic<size_t> liveBytes{0};
+    static inline std::atomic<size_t> peakBytes{0};
+};
+
+#endif //RAYTRACING_MEMORYARENA_H
@@ -5,10 +5,12 @@
 #ifndef RAYTRACING_OBJECT_H
 #define RAYTRACING_OBJECT_H
 
+#include <vector>
 #include "Vector.hpp"
 #include "global.hpp"
 #include "Bounds3.hpp"
 #include "Ray.hpp"
+#include "RayPacket.hpp"
 #include "Intersection.hpp"
 
 class Object
@@ -18,13 +20,59 @@ public:
     virtual ~Object() {}
     virtual bool intersect(const Ray& ray) = 0;
     virtual bool intersect(const Ray& ray, float &, uint32_t &) const = 0;
-    virtual Intersection getIntersection(Ray _ray) = 0;
+    // closest hit test: updates hit and returns true only when the ray
+    // hits this object closer than hit.t
+    virtual bool intersect(const Ray& ray, HitRecord &hit) = 0;
+    // the same with the ray's shear computed by the caller once per
+    // traversal; only triangles use it
+    virtual bool intersect(const Ray& ray, const RayShear &, HitRecord &hit) {
+        return intersect(ray, hit);
+    }
+    // any hit in (t_min, t_max), with the shear as above
+    virtual bool occluded(const Ray& ray, const RayShear &) {
+        return intersect(ray);
+    }
+    // the same for the active lanes of a packet, by default lane by lane
+    virtual void intersect(const RayPacket &packet, const bool *active,
+                           HitRecord *hits) {
+        for (int i = 0; i < RayPacket::SIZE; ++i)
+            if (active[i]) intersect(packet.ray(i), hits[i]);
+    }
+    // any hit in each active lane's (tmin, tmax), setting occluded[i] for
+    // the lanes blocked, by default lane by lane
+    virtual void occluded(const RayPacket &packet, const bool *active,
+                          bool *occluded) {
+        for (int i = 0; i < RayPacket::SIZE; ++i)
+            if (active[i] && intersect(packet.ray(i))) occluded[i] = true;
+    }
+    // position, normal, material and emission of a hit found by intersect
+    virtual Intersection getSurfaceInteraction(const Ray &ray, const HitRecord &hit) = 0;
+    Intersection getIntersection(const Ray &ray) {
+        HitRecord hit;
+        if (!intersect(ray, hit)) return Intersection();
+        return hit.prim->getSurfaceInteraction(ray, hit);
+    }
     virtual void getSurfaceProperties(const Vector3f &, const Vector3f &, const uint32_t &, const Vector2f &, Vector3f &, Vector2f &) const = 0;
     virtual Vector3f evalDiffuseColor(const Vector2f &) const =0;
     virtual Bounds3 getBounds()=0;
+    // bounds at the end of the shutter interval, getBounds() being those at
+    // its start; objects move linearly in between
+    virtual Bounds3 getEndBounds() { return getBounds(); }
     virtual float getArea()=0;
     virtual void Sample(Intersection &pos, float &pdf)=0;
     virtual bool hasEmit()=0;
+    virtual Vector3f getEmission()=0;
+    // append the primitives sampleLight should choose from, by default the
+    // object itself when it is emissive
+    virtual void getEmitters(std::vector<Object*> &emitters) {
+        if (hasEmit()) emitters.push_back(this);
+    }
+    // bound the surface normals around axis, returns the spread angle
+    // (pi when the object faces every direction)
+    virtual float getNormalCone(Vector3f &axis) {
+        axis = Vector3f(0, 0, 1);
+        return M_PI;
+    }
 
     std::string tag = "";
 };
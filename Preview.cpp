@@ -0,0 +1,142 @@
+#include "Preview.hpp"
+#include "Image.hpp"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+// lines read from the command stream, handed to the render loop
+struct Inbox {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::string> lines;
+    bool closed = false;
+};
+
+} // namespace
+
+void Preview::run(std::istream &commands, const std::string &ppmPath, int initialScale)
+{
+    // the reader may block on input long after the render loop has quit,
+    // so it shares ownership of the inbox and is not joined
+    auto inbox = std::make_shared<Inbox>();
+    std::thread([inbox, &commands]() {
+        std::string line;
+        while (std::getline(commands, line)) {
+            std::lock_guard<std::mutex> lock(inbox->mutex);
+            inbox->lines.push_back(line);
+            inbox->ready.notify_one();
+        }
+        std::lock_guard<std::mutex> lock(inbox->mutex);
+        inbox->closed = true;
+        inbox->ready.notify_one();
+    }).detach();
+
+    const int fullWidth = scene.width, fullHeight = scene.height;
+    const uint32_t baseSeed = scene.seed;
+    scale = std::max(1, initialScale);
+    passes = 0;
+    std::vector<Vector3f> sum, image;
+    bool restart = true;
+
+    for (;;) {
+        std::deque<std::string> lines;
+        {
+            std::unique_lock<std::mutex> lock(inbox->mutex);
+            // once the image is complete, sleep until there is input
+            inbox->ready.wait(lock, [&]() {
+                return passes < scene.spp || !inbox->lines.empty() || inbox->closed;
+            });
+            lines.swap(inbox->lines);
+            if (lines.empty() && inbox->closed && passes >= scene.spp)
+                break;
+        }
+
+        bool quit = false;
+        for (const std::string &line : lines) {
+            std::istringstream in(line.substr(0, line.find('#')));
+            std::vector<std::string> command;
+            std::string token;
+            while (in >> token)
+                command.push_back(token);
+            if (!command.empty() && !apply(command, restart)) {
+                quit = true;
+                break;
+            }
+        }
+        if (quit)
+            break;
+
+        if (restart) {
+            scene.width = std::max(1, fullWidth / scale);
+            scene.height = std::max(1, fullHeight / scale);
+            sum.assign(scene.width * scene.height, Vector3f(0.0f));
+            image.resize(sum.size());
+            passes = 0;
+            restart = false;
+        }
+        if (passes >= scene.spp)
+            continue;
+
+        // every pass draws different samples, and a restarted image the
+        // same ones as the first time
+        scene.seed = mix_seed(baseSeed, passes);
+        std::vector<Vector3f> pass = renderer.RenderImage(scene, scene.cameras[view], 1);
+        ++passes;
+        for (size_t i = 0; i < sum.size(); ++i) {
+            sum[i] += pass[i];
+            image[i] = sum[i] / passes;
+        }
+        if (!writePPM(ppmPath, scene.width, scene.height, image))
+            std::cerr << "Cannot write " << ppmPath << "\n";
+        std::cout << "Pass " << passes << "/" << scene.spp << "\n";
+    }
+
+    scene.width = fullWidth;
+    scene.height = fullHeight;
+    scene.seed = baseSeed;
+}
+
+bool Preview::apply(const std::vector<std::string> &command, bool &restart)
+{
+    const std::string &name = command[0];
+    if (name == "quit")
+        return false;
+
+    std::string error;
+    if (name == "material" && command.size() >= 3) {
+        std::vector<std::string> args(command.begin() + 3, command.end());
+        if (loader.editMaterial(scene, command[1], command[2], args, error))
+            restart = true;
+    } else if (name == "camera" && command.size() == 2) {
+        size_t i = 0;
+        while (i < scene.cameras.size() && scene.cameras[i].name != command[1])
+            ++i;
+        if (i < scene.cameras.size()) {
+            view = i;
+            restart = true;
+        } else {
+            error = "no camera '" + command[1] + "'";
+        }
+    } else if ((name == "scale" || name == "spp") && command.size() == 2) {
+        int value = std::atoi(command[1].c_str());
+        if (value < 1) {
+            error = "bad value for '" + name + "'";
+        } else if (name == "scale") {
+            scale = value;
+            restart = true;
+        } else {
+            // more passes continue the current image
+            scene.spp = value;
+        }
+    } else {
+        error = "unknown command '" + name + "'";
+    }
+    if (!error.empty())
+        std::cerr << error << "\n";
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef RAYTRACING_PREVIEW_H
+#define RAYTRACING_PREVIEW_H
+
+#include <istream>
+#include <string>
+#include <vector>
+#include "Renderer.hpp"
+#include "SceneLoader.hpp"
+
+// Interactive look development: the loaded scene and its BVHs stay
+// resident and are rendered progressively, one sample per pixel per pass
+// at a fraction of the scene's resolution, with the running average
+// written to a PPM after every pass. Commands are read line by line while
+// rendering and applied between passes:
+//
+//   material white kd 0.8 0.2 0.2  sets a key as in the material block,
+//                                  restarts the accumulation
+//   camera side                    the view to render, restarts
+//   scale 2                        divides the resolution, restarts
+//   spp 256                        passes after which it waits for input
+//   quit
+//
+// Nothing is reloaded or rebuilt for an edit. At the end of the input the
+// current image is finished before run returns.
+class Preview
+{
+public:
+    Preview(Scene &scene, SceneLoader &loader, Renderer &renderer)
+        : scene(scene), loader(loader), renderer(renderer) {}
+
+    void run(std::istream &commands, const std::string &ppmPath, int scale);
+
+private:
+    // false for quit; sets restart if the image has to start over
+    bool apply(const std::vector<std::string> &command, bool &restart);
+
+    Scene &scene;
+    SceneLoader &loader;
+    Renderer &renderer;
+    size_t view = 0;
+    int scale = 1;
+    int passes = 0;
+};
+
+#endif //RAYTRACING_PREVIEW_H
@@ -4,26 +4,100 @@
 
 #ifndef RAYTRACING_RAY_H
 #define RAYTRACING_RAY_H
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <utility>
 #include "Vector.hpp"
 struct Ray{
-    //Destination = origin + t*direction
+    //Destination = origin + t*direction, for t in (t_min, t_max)
     Vector3f origin;
     Vector3f direction, direction_inv;
-    double t;//transportation time,
-    double t_min, t_max;
-
-    Ray(const Vector3f& ori, const Vector3f& dir, const double _t = 0.0): origin(ori), direction(dir),t(_t) {
-        direction_inv = Vector3f(1./direction.x, 1./direction.y, 1./direction.z);
-        t_min = 0.0;
-        t_max = std::numeric_limits<double>::max();
+    float t;//transportation time, in the shutter interval [0, 1)
+    float t_min, t_max;
+    // direction sign per axis, 1 if negative, used to order BVH traversal
+    uint8_t dirIsNeg[3];
 
+    Ray(const Vector3f& ori, const Vector3f& dir, const float _t = 0.0f,
+        const float _t_max = std::numeric_limits<float>::max())
+        : origin(ori), direction(dir), t(_t), t_min(0.0f), t_max(_t_max) {
+        direction_inv = Vector3f(1.0f/direction.x, 1.0f/direction.y, 1.0f/direction.z);
+        dirIsNeg[0] = direction.x < 0;
+        dirIsNeg[1] = direction.y < 0;
+        dirIsNeg[2] = direction.z < 0;
     }
 
-    Vector3f operator()(double t) const{return origin+direction*t;}
+    Vector3f operator()(float t) const{return origin+direction*t;}
 
     friend std::ostream &operator<<(std::ostream& os, const Ray& r){
         os<<"[origin:="<<r.origin<<", direction="<<r.direction<<", time="<< r.t<<"]\n";
         return os;
     }
 };
+
+// Shear that maps a ray onto +z for the watertight triangle test: kz is the
+// dominant direction axis, kx/ky the other two (swapped to keep the
+// winding), S = (dx/dz, dy/dz, 1/dz) in that permuted frame. Traversals
+// compute it once and hand it to the triangles, rather than every Ray
+// carrying it.
+struct RayShear {
+    uint8_t kx, ky, kz;
+    float Sx, Sy, Sz;
+
+    RayShear() = default;
+    explicit RayShear(const Vector3f& direction) {
+        Vector3f a(std::fabs(direction.x), std::fabs(direction.y),
+                   std::fabs(direction.z));
+        kz = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        if (direction[kz] < 0)
+            std::swap(kx, ky);
+        Sz = 1.0f / direction[kz];
+        Sx = direction[kx] * Sz;
+        Sy = direction[ky] * Sz;
+    }
+};
+
+// Move a point on a surface off it along the normal n by a few ulps, so
+// that rays leaving it do not hit the same surface again (Waechter and
+// Binder, "A Fast and Robust Method for Avoiding Self-Intersection")
+inline Vector3f offsetRayOrigin(const Vector3f &p, const Vector3f &n)
+{
+    const float origin = 1.0f / 32.0f;
+    const float float_scale = 1.0f / 65536.0f;
+    const float int_scale = 256.0f;
+
+    Vector3f result;
+    for (int i = 0; i < 3; ++i) {
+        int of = int(int_scale * n[i]);
+        float pi = p[i];
+        int32_t bits;
+        std::memcpy(&bits, &pi, sizeof(bits));
+        bits += (pi < 0) ? -of : of;
+        float moved;
+        std::memcpy(&moved, &bits, sizeof(moved));
+        result[i] = std::fabs(pi) < origin ? pi + float_scale * n[i] : moved;
+    }
+    return result;
+}
+
+// offset p to the side of the surface with normal n that w points into
+inline Vector3f offsetRayOrigin(const Vector3f &p, const Vector3f &n, const Vector3f &w)
+{
+    return offsetRayOrigin(p, dotProduct(n, w) < 0 ? -n : n);
+}
+
+// Ray leaving surface point p (normal n) towards surface point q (normal
+// nq), ending just short of q so that it can be used for visibility
+inline Ray spawnRayTo(const Vector3f &p, const Vector3f &n,
+                      const Vector3f &q, const Vector3f &nq, float time = 0.0f)
+{
+    Vector3f d = q - p;
+    Vector3f from = offsetRayOrigin(p, n, d);
+    Vector3f to = offsetRayOrigin(q, nq, -d);
+    d = to - from;
+    float dist = d.norm();
+    return Ray(from, d / dist, time, dist * (1.0f - 1e-4f));
+}
 #endif //RAYTRACING_RAY_H
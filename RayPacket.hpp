@@ -0,0 +1,64 @@
+#ifndef RAYTRACING_RAYPACKET_H
+#define RAYTRACING_RAYPACKET_H
+
+#include "Ray.hpp"
+
+// number of rays traced together, 4, 8 or 16
+#ifndef RAY_PACKET_SIZE
+#define RAY_PACKET_SIZE 8
+#endif
+
+// A packet of rays in SoA layout, so that a box or triangle test runs over
+// all lanes in one vectorizable loop. Lanes with active[i] == false are
+// carried along but never reported as hit.
+struct RayPacket {
+    static const int SIZE = RAY_PACKET_SIZE;
+    static_assert(SIZE == 4 || SIZE == 8 || SIZE == 16, "unsupported packet size");
+
+    alignas(64) float ox[SIZE], oy[SIZE], oz[SIZE];
+    alignas(64) float dx[SIZE], dy[SIZE], dz[SIZE];
+    alignas(64) float ix[SIZE], iy[SIZE], iz[SIZE];
+    alignas(64) float tmin[SIZE], tmax[SIZE];
+    // per-lane shear of the watertight triangle test, see RayShear
+    alignas(64) float sx[SIZE], sy[SIZE], sz[SIZE];
+    uint8_t kx[SIZE], ky[SIZE], kz[SIZE];
+    bool active[SIZE];
+    // shutter time, shared by all lanes so that a node is tested against
+    // one set of interpolated bounds
+    float time = 0.0f;
+
+    RayPacket() { for (int i = 0; i < SIZE; ++i) active[i] = false; }
+
+    void set(int lane, const Ray &ray)
+    {
+        ox[lane] = ray.origin.x; oy[lane] = ray.origin.y; oz[lane] = ray.origin.z;
+        dx[lane] = ray.direction.x; dy[lane] = ray.direction.y; dz[lane] = ray.direction.z;
+        ix[lane] = ray.direction_inv.x; iy[lane] = ray.direction_inv.y;
+        iz[lane] = ray.direction_inv.z;
+        tmin[lane] = ray.t_min;
+        tmax[lane] = ray.t_max;
+        RayShear s(ray.direction);
+        sx[lane] = s.Sx; sy[lane] = s.Sy; sz[lane] = s.Sz;
+        kx[lane] = s.kx; ky[lane] = s.ky; kz[lane] = s.kz;
+        active[lane] = true;
+        time = ray.t;
+    }
+
+    Ray ray(int lane) const
+    {
+        Ray r(Vector3f(ox[lane], oy[lane], oz[lane]),
+              Vector3f(dx[lane], dy[lane], dz[lane]), time, tmax[lane]);
+        r.t_min = tmin[lane];
+        return r;
+    }
+
+    RayShear shear(int lane) const
+    {
+        RayShear s;
+        s.kx = kx[lane]; s.ky = ky[lane]; s.kz = kz[lane];
+        s.Sx = sx[lane]; s.Sy = sy[lane]; s.Sz = sz[lane];
+        return s;
+    }
+};
+
+#endif //RAYTRACING_RAYPACKET_H
@@ -0,0 +1,207 @@
+#include "RenderServer.hpp"
+#include "Renderer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+bool sendAll(int fd, const void *data, size_t size)
+{
+    const char *p = static_cast<const char*>(data);
+    while (size > 0) {
+        // a client that went away must not kill the server with SIGPIPE
+        ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        p += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool sendLine(int fd, const std::string &line)
+{
+    std::string text = line + "\n";
+    return sendAll(fd, text.data(), text.size());
+}
+
+// the next line from fd without the newline, buffering what was read
+// beyond it; false at the end of the connection
+bool readLine(int fd, std::string &buffer, std::string &line)
+{
+    size_t end;
+    while ((end = buffer.find('\n')) == std::string::npos) {
+        char chunk[4096];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buffer.append(chunk, n);
+    }
+    line = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+    return true;
+}
+
+} // namespace
+
+bool RenderServer::run()
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << socketPath << "\n";
+        return false;
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        std::cerr << "Cannot create socket: " << std::strerror(errno) << "\n";
+        return false;
+    }
+    // a socket file left behind by an earlier server
+    unlink(socketPath.c_str());
+    if (bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+        listen(server, 8) < 0) {
+        std::cerr << "Cannot listen on " << socketPath << ": " << std::strerror(errno) << "\n";
+        close(server);
+        return false;
+    }
+    std::cout << "Listening on " << socketPath << "\n";
+
+    for (;;) {
+        int connection = accept(server, nullptr, nullptr);
+        if (connection < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "accept: " << std::strerror(errno) << "\n";
+            break;
+        }
+        bool more = serve(connection);
+        close(connection);
+        if (!more)
+            break;
+    }
+
+    close(server);
+    unlink(socketPath.c_str());
+    return true;
+}
+
+bool RenderServer::serve(int connection)
+{
+    std::string buffer, line;
+    Job job;
+    while (readLine(connection, buffer, line)) {
+        std::istringstream in(line.substr(0, line.find('#')));
+        std::string key;
+        if (!(in >> key))
+            continue;
+
+        bool ok = true;
+        if (key == "shutdown") {
+            return false;
+        } else if (key == "scene") {
+            ok = static_cast<bool>(in >> job.scene);
+        } else if (key == "camera") {
+            ok = static_cast<bool>(in >> job.camera);
+        } else if (key == "spp") {
+            ok = (in >> job.spp) && job.spp >= 1;
+        } else if (key == "resolution") {
+            ok = (in >> job.width >> job.height) && job.width >= 1 && job.height >= 1;
+        } else if (key == "render") {
+            bool sent = job.scene.empty() ? sendLine(connection, "error no scene given")
+                                          : render(connection, job);
+            if (!sent)
+                return true;
+            job = Job();
+            continue;
+        } else {
+            sendLine(connection, "error unknown key '" + key + "'");
+            continue;
+        }
+        if (!ok)
+            sendLine(connection, "error bad value for '" + key + "'");
+    }
+    return true;
+}
+
+bool RenderServer::render(int connection, const Job &job)
+{
+    auto start = std::chrono::steady_clock::now();
+    Scene scene;
+    scene.t_pool.threads = threads;
+    scene.t_pool.pin = pinThreads;
+    SceneLoader loader(cache);
+    if (!loader.load(job.scene, scene))
+        return sendLine(connection, "error cannot load scene " + job.scene);
+    if (job.spp > 0)
+        scene.spp = job.spp;
+    if (job.width > 0) {
+        scene.width = job.width;
+        scene.height = job.height;
+    }
+    const Camera *camera = &scene.cameras[0];
+    if (!job.camera.empty()) {
+        camera = nullptr;
+        for (const Camera &c : scene.cameras)
+            if (c.name == job.camera)
+                camera = &c;
+        if (!camera)
+            return sendLine(connection, "error no camera '" + job.camera + "'");
+    }
+    scene.buildBVH();
+    std::cout << "Asset cache: " << cache->files() << " files, "
+              << cache->meshes() << " meshes\n";
+
+    Renderer renderer;
+    const uint32_t baseSeed = scene.seed;
+    std::vector<Vector3f> sum(scene.width * scene.height, Vector3f(0.0f));
+    std::vector<float> tile;
+    for (int done = 0; done < scene.spp; ) {
+        // passes of 1, 1, 2, 4, ... samples, so the first image comes fast
+        // and later ones double the sample count
+        int spp = std::min(std::max(done, 1), scene.spp - done);
+        scene.seed = mix_seed(baseSeed, done);
+        std::vector<Vector3f> pass = renderer.RenderImage(scene, *camera, spp);
+        for (size_t i = 0; i < sum.size(); ++i)
+            sum[i] += pass[i] * spp;
+        done += spp;
+
+        for (int y = 0; y < scene.height; y += tileSize) {
+            for (int x = 0; x < scene.width; x += tileSize) {
+                int w = std::min(tileSize, scene.width - x);
+                int h = std::min(tileSize, scene.height - y);
+                tile.resize(3 * w * h);
+                for (int j = 0; j < h; ++j) {
+                    for (int i = 0; i < w; ++i) {
+                        Vector3f p = sum[(y + j) * scene.width + x + i] / done;
+                        float *t = &tile[3 * (j * w + i)];
+                        t[0] = p.x;
+                        t[1] = p.y;
+                        t[2] = p.z;
+                    }
+                }
+                std::ostringstream header;
+                header << "tile " << x << " " << y << " " << w << " " << h << " " << done;
+                if (!sendLine(connection, header.str()) ||
+                    !sendAll(connection, tile.data(), tile.size() * sizeof(float)))
+                    return false;
+            }
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return sendLine(connection, "done " + std::to_string(elapsed.count()));
+}
@@ -0,0 +1,61 @@
+#ifndef RAYTRACING_RENDERSERVER_H
+#define RAYTRACING_RENDERSERVER_H
+
+#include <memory>
+#include <string>
+#include "SceneLoader.hpp"
+
+// A render daemon for many small renders of the same assets: it listens
+// on a Unix domain socket and renders the jobs it receives one at a time,
+// keeping the parsed OBJ files and built mesh BVHs of all jobs in an
+// SceneLoader::AssetCache. A job is a few text lines, as in a scene file:
+//
+//   scene ../scenes/cornellbox.scene   required
+//   camera front                       optional, the first camera if not
+//   spp 64                             optional, overrides the scene
+//   resolution 256 256                 optional, overrides the scene
+//   render                             starts the job
+//
+// and "shutdown" stops the server. The image is rendered progressively
+// in passes of 1, 1, 2, 4, ... samples per pixel; after every pass the
+// running average is sent back as tiles, each a text line
+//
+//   tile <x> <y> <width> <height> <spp>
+//
+// followed by width * height RGB pixels as little endian floats, row by
+// row from the top. A job ends with "done <seconds>" or "error <message>".
+// A connection may send any number of jobs.
+class RenderServer
+{
+public:
+    explicit RenderServer(const std::string &socketPath, int tileSize = 64)
+        : socketPath(socketPath), tileSize(tileSize),
+          cache(std::make_shared<SceneLoader::AssetCache>()) {}
+
+    // render threads and their pinning for every job, see Scene::ThreadPool
+    int threads = 0;
+    bool pinThreads = false;
+
+    // Serves until a client sends shutdown. false, with the error printed
+    // to std::cerr, if the socket cannot be set up.
+    bool run();
+
+private:
+    struct Job {
+        std::string scene;
+        std::string camera;
+        int spp = 0;
+        int width = 0, height = 0;
+    };
+
+    // false once the client asked for shutdown
+    bool serve(int connection);
+    // false if the connection broke while sending the result
+    bool render(int connection, const Job &job);
+
+    std::string socketPath;
+    int tileSize;
+    std::shared_ptr<SceneLoader::AssetCache> cache;
+};
+
+#endif //RAYTRACING_RENDERSERVER_H
@@ -5,30 +5,25 @@
 #include <fstream>
 #include "Scene.hpp"
 #include "Renderer.hpp"
+#include "Wavefront.hpp"
+#include "Image.hpp"
 #include <atomic>
 
 
-inline float deg2rad(const float& deg) { return deg * M_PI / 180.0; }
-
 const float EPSILON = 0.00001;
 
-// The main render function. This where we iterate over all pixels in the image,
-// generate primary rays and cast these rays into the scene. The content of the
-// framebuffer is saved to a file.
-void Renderer::Render(Scene& scene)
+// Radiance of every pixel at spp samples per pixel, row by row. Every task
+// reseeds its thread's random numbers from the scene seed and the pixels it
+// covers, so the result does not depend on the scheduling.
+std::vector<Vector3f> Renderer::RenderImage(Scene& scene, const Camera& view,
+                                            int spp)
 {
-    Vector3f framebuffer[scene.width * scene.height];
+    std::vector<Vector3f> framebuffer(scene.width * scene.height);
 
-    float scale = tan(deg2rad(scene.fov * 0.5));
-    float imageAspectRatio = scene.width / (float)scene.height;
-    Vector3f eye_pos(278, 273, -800);
-    int m = 0;
+    Camera camera = view;
+    camera.setup(scene.width, scene.height);
 
-    // change the spp value to change sample ammount
-    int spp = 1024;
-    std::cout << "SPP: " << spp << "\n";
-
-    std::atomic<int> total_num;
+    std::atomic<int> total_num{0};
 
     auto counter = std::thread([&]() {
         while(total_num != scene.height*scene.width) {
@@ -45,67 +40,124 @@ void Renderer::Render(Scene& scene)
     int NUM_OF_PRODUCERS = 8;
     std::thread producers[NUM_OF_PRODUCERS];
 
-    auto producer_task = [&](int start, int end) {
+    // the wavefront integrator is handed a whole row per task, so that it
+    // can keep a large batch of rays in flight
+    auto wavefront_task = [&](int start, int end) {
         for (uint32_t j = start; j < end; ++j) {
-            for (uint32_t i = 0; i < scene.width; ++i) {
-
-                float x = (2 * (i + 0.5) / (float)scene.width - 1) *
-                                imageAspectRatio * scale;
-                float y = (1 - 2 * (j + 0.5) / (float)scene.height) * scale;
+            auto fb_ptr = framebuffer.data();
+
+            scene.t_pool.produce([&scene, &camera, spp, fb_ptr, j, &total_num]() {
+                seed_random(mix_seed(scene.seed, j));
+                std::vector<Vector3f> row;
+                WavefrontIntegrator(scene).render([&](uint32_t i) {
+                    return camera.generateRay(i, j, scene.sampleTime());
+                }, scene.width, spp, row);
+                for (uint32_t i = 0; i < scene.width; ++i)
+                    fb_ptr[j*scene.width+i] = row[i];
+                total_num += scene.width;
+            });
+        }
+    };
 
-                Vector3f dir = normalize(Vector3f(-x, y, 1));
-                
-                const Ray primaryRay = Ray(eye_pos, dir);
-                auto fb_ptr = framebuffer;
+    auto producer_task = [&](int start, int end) {
+        if (scene.integrator == Scene::Integrator::WAVEFRONT) {
+            wavefront_task(start, end);
+            return;
+        }
+        // neighbouring pixels of a row are traced together as a packet
+        for (uint32_t j = start; j < end; ++j) {
+            for (uint32_t i = 0; i < scene.width; i += RayPacket::SIZE) {
+                int lanes = std::min<int>(RayPacket::SIZE, scene.width - i);
+                auto fb_ptr = framebuffer.data();
 
-                scene.t_pool.produce([&scene, spp, primaryRay, 
+                scene.t_pool.produce([&scene, &camera, spp, lanes,
                     fb_ptr, i, j, &total_num]() {
-                    Vector3f mean = 0.0f;
-                    
+                    seed_random(mix_seed(scene.seed, j * scene.width + i));
+                    Vector3f mean[RayPacket::SIZE], radiance[RayPacket::SIZE];
+
+                    // First-hit cache: the primary hits are traced for the
+                    // first samples only and shaded again by the later ones.
+                    // Rays that never change need one set of hits; changing
+                    // rays keep a grid of axis x axis strata of the pixel if
+                    // the scene asks for it, and are traced every time if not.
+                    bool varying = camera.jittered() || scene.moving();
+                    int axis = varying ?
+                        (int)std::lround(std::sqrt(std::max(scene.primarySamples, 0))) : 1;
+                    while (axis * axis > spp) --axis;
+                    int strata = std::max(axis * axis, 1);
+                    std::vector<RayPacket> packets(strata);
+                    std::vector<Intersection> hits(strata * RayPacket::SIZE);
+
+                    auto generate = [&](RayPacket &packet, int s) {
+                        float time = scene.sampleTime();
+                        for (int l = 0; l < lanes; ++l) {
+                            if (axis == 0 || !varying) {
+                                packet.set(l, camera.generateRay(i + l, j, time));
+                                continue;
+                            }
+                            float ux = (s % axis + get_random_float()) / axis;
+                            float uy = (s / axis + get_random_float()) / axis;
+                            packet.set(l, camera.generateRay(i + l, j, time,
+                                                             Vector2f(ux, uy)));
+                        }
+                        packet.time = time;
+                    };
+
                     for (int k = 0; k < spp; k++){
-                        mean += scene.castRay(primaryRay, 0) / spp;  
+                        int s = k % strata;
+                        RayPacket &packet = packets[s];
+                        Intersection *cached = hits.data() + s * RayPacket::SIZE;
+                        if (k < strata || axis == 0) {
+                            generate(packet, s);
+                            scene.intersectPacket(packet, cached);
+                        }
+                        scene.shadePacket(packet, cached, radiance);
+                        for (int l = 0; l < lanes; ++l)
+                            mean[l] += radiance[l] / spp;
                     }
-                    fb_ptr[j*scene.width+i] = mean;
-                    ++total_num;
-                });              
+                    for (int l = 0; l < lanes; ++l)
+                        fb_ptr[j*scene.width+i+l] = mean[l];
+                    total_num += lanes;
+                });
             }
         }
     };
 
-    for (int i = 0; i < NUM_OF_PRODUCERS; ++i) {
-        int start = (i)*(height/NUM_OF_PRODUCERS);
-        int end = (i+1)*(height/NUM_OF_PRODUCERS);
-        if (i == NUM_OF_PRODUCERS-1) end = height; 
-        producers[i] = std::thread(producer_task, start, end);
-    }
+    {
+        Stats::Timer renderTimer(Stats::RENDER);
+        for (int i = 0; i < NUM_OF_PRODUCERS; ++i) {
+            int start = (i)*(height/NUM_OF_PRODUCERS);
+            int end = (i+1)*(height/NUM_OF_PRODUCERS);
+            if (i == NUM_OF_PRODUCERS-1) end = height; 
+            producers[i] = std::thread(producer_task, start, end);
+        }
+
+        for (int i = 0; i < NUM_OF_PRODUCERS; ++i) {
+            producers[i].join();
+        }
 
-    for (int i = 0; i < NUM_OF_PRODUCERS; ++i) {
-        producers[i].join();
+        counter.join();
+        UpdateProgress(1.f);
     }
 
-    counter.join();
-    UpdateProgress(1.f);
+    return framebuffer;
+}
+
+// The main render function. This where we iterate over all pixels in the image,
+// generate primary rays and cast these rays into the scene. The content of the
+// framebuffer is saved to ppmPath, and as floats to pfmPath if given.
+void Renderer::Render(Scene& scene, const Camera& camera,
+                      const std::string& ppmPath, const std::string& pfmPath)
+{
+    std::cout << "SPP: " << scene.spp << "\n";
+    std::vector<Vector3f> framebuffer = RenderImage(scene, camera, scene.spp);
 
     // save framebuffer to file
-    FILE* fp = fopen("binary.ppm", "wb");
-    // int count = 0;
-    // int m_count = 0;
-    (void)fprintf(fp, "P6\n%d %d\n255\n", scene.width, scene.height);
-    for (auto i = 0; i < scene.height * scene.width; ++i) {
-        static unsigned char color[3];
-        if (framebuffer[i].norm() > EPSILON) {
-            // ++count;
-            color[0] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].x), 0.6f));
-            color[1] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].y), 0.6f));
-            color[2] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].z), 0.6f));
-        } else {
-            color[0] = 0;
-            color[1] = 0;
-            color[2] = 0;
-        }
-        // if (color[0] > EPSILON || color[1] > EPSILON || color[2] > EPSILON) ++m_count;
-        fwrite(color, 1, 3, fp);
+    Stats::Timer outputTimer(Stats::OUTPUT);
+    if (!pfmPath.empty() && !writePFM(pfmPath, scene.width, scene.height, framebuffer)) {
+        std::cerr << "Cannot write " << pfmPath << "\n";
+    }
+    if (!writePPM(ppmPath, scene.width, scene.height, framebuffer)) {
+        std::cerr << "Cannot write " << ppmPath << "\n";
     }
-    // std::cout << count << " " <<m_count << std::endl;
-    fclose(fp);    
 }
@@ -15,7 +15,10 @@ struct hit_payload
 class Renderer
 {
 public:
-    void Render(Scene& scene);
+    void Render(Scene& scene, const Camera& camera,
+                const std::string& ppmPath = "binary.ppm",
+                const std::string& pfmPath = "");
+    std::vector<Vector3f> RenderImage(Scene& scene, const Camera& camera, int spp);
 
 private:
 };
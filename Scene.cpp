@@ -7,7 +7,45 @@
 
 void Scene::buildBVH() {
     printf(" - Generating BVH...\n\n");
-    this->bvh = new BVHAccel(objects, 1, BVHAccel::SplitMethod::NAIVE);
+    bvh.reset();
+    bvh = std::make_unique<BVHAccel>(objects, 1, BVHAccel::SplitMethod::NAIVE);
+    buildLights();
+}
+
+float Scene::sampleTime() const
+{
+    // static scenes keep time 0 and do not draw a random number for it, so
+    // their images do not change
+    return moving() ? get_random_float() : 0.0f;
+}
+
+bool Scene::updateBVH(float maxCostRatio) {
+    bool rebuilt = bvh->Update(maxCostRatio);
+    buildLights();
+    return rebuilt;
+}
+
+static inline float luminance(const Vector3f &c)
+{
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+void Scene::buildLights()
+{
+    // gather emissive primitives once, weighted by the power they emit
+    emitters.clear();
+    emitterIndex.clear();
+    for (auto object : objects)
+        object->getEmitters(emitters);
+
+    std::vector<float> weights(emitters.size());
+    for (int i = 0; i < emitters.size(); ++i) {
+        weights[i] = emitters[i]->getArea() *
+            luminance(emitters[i]->getEmission());
+        emitterIndex[emitters[i]] = i;
+    }
+    emitterTable.build(weights);
+    lightBVH.build(emitters, weights);
 }
 
 Intersection Scene::intersect(const Ray &ray) const
@@ -15,25 +53,67 @@ Intersection Scene::intersect(const Ray &ray) const
     return this->bvh->Intersect(ray);
 }
 
+bool Scene::intersect(const Ray &ray, HitRecord &hit) const
+{
+    return this->bvh->Intersect(ray, hit);
+}
+
+bool Scene::occluded(const Ray &ray) const
+{
+    STAT_RAY(SHADOW, 1);
+    return this->bvh->IntersectP(ray);
+}
+
 void Scene::sampleLight(Intersection &pos, float &pdf) const
 {
-    float emit_area_sum = 0;
-    for (uint32_t k = 0; k < objects.size(); ++k) {
-        if (objects[k]->hasEmit()){
-            emit_area_sum += objects[k]->getArea();
-        }
+    if (emitterTable.empty()) {
+        pdf = 0.0f;
+        return;
     }
-    float p = get_random_float() * emit_area_sum;
-    emit_area_sum = 0;
-    for (uint32_t k = 0; k < objects.size(); ++k) {
-        if (objects[k]->hasEmit()){
-            emit_area_sum += objects[k]->getArea();
-            if (p <= emit_area_sum){
-                objects[k]->Sample(pos, pdf);
-                break;
-            }
-        }
+    int k = emitterTable.sample(get_random_float());
+    emitters[k]->Sample(pos, pdf);
+    pdf *= emitterTable.pmf(k);
+}
+
+float Scene::pdfLight(const Intersection &pos) const
+{
+    // probability density (per unit area) of sampleLight choosing pos
+    if (!pos.happened || !pos.obj)
+        return 0.0f;
+    auto it = emitterIndex.find(pos.obj);
+    if (it == emitterIndex.end())
+        return 0.0f;
+    return emitterTable.pmf(it->second) / emitters[it->second]->getArea();
+}
+
+void Scene::sampleLight(const Intersection &ref, Intersection &pos, float &pdf) const
+{
+    if (lightSampling != LightSampling::LIGHT_BVH) {
+        sampleLight(pos, pdf);
+        return;
     }
+    float pmf;
+    int k = lightBVH.sample(ref.coords, normalize(ref.normal),
+                            get_random_float(), pmf);
+    if (k < 0) {
+        pdf = 0.0f;
+        return;
+    }
+    emitters[k]->Sample(pos, pdf);
+    pdf *= pmf;
+}
+
+float Scene::pdfLight(const Intersection &ref, const Intersection &pos) const
+{
+    if (lightSampling != LightSampling::LIGHT_BVH)
+        return pdfLight(pos);
+    if (!pos.happened || !pos.obj)
+        return 0.0f;
+    auto it = emitterIndex.find(pos.obj);
+    if (it == emitterIndex.end())
+        return 0.0f;
+    return lightBVH.pmf(ref.coords, normalize(ref.normal), it->second) /
+        emitters[it->second]->getArea();
 }
 
 bool Scene::trace(
@@ -57,53 +137,292 @@ bool Scene::trace(
     return (*hitObject != nullptr);
 }
 
+Vector3f Scene::castPrimaryRay(const Ray &ray)
+{
+    switch (integrator) {
+    case Integrator::MIS:
+        return castRayMIS(ray);
+    case Integrator::PATH:
+    case Integrator::WAVEFRONT:
+    default:
+        return castRay(ray);
+    }
+}
+
+// Russian roulette driven by the path throughput: dim paths are likely to
+// be terminated, survivors are reweighted to keep the estimate unbiased
+bool Scene::russianRoulette(Vector3f &throughput) const
+{
+    float survival = std::min(RussianRoulette,
+        std::max(throughput.x, std::max(throughput.y, throughput.z)));
+    if (survival <= 0.0f || get_random_float() >= survival)
+        return false;
+    throughput = throughput / survival;
+    return true;
+}
+
 // Implementation of Path Tracing
-Vector3f Scene::castRay(const Ray &ray, int depth) {
+Vector3f Scene::castRay(const Ray &ray)
+{
+    STAT_RAY(CAMERA, 1);
+    return tracePath(ray, intersect(ray), 0, Vector3f(1.0f));
+}
+
+// Light sample for the path vertex seen from direction wo: false if it
+// cannot contribute, otherwise the shadow ray to test and the radiance per
+// unit path throughput that arrives when that ray is unoccluded. Emitters
+// take no light sample, their emission ends the path.
+bool Scene::sampleDirect(const Intersection &vertex, const Vector3f &wo,
+                         float time, Ray &shadow, Vector3f &contribution) const
+{
+    if (vertex.emit.norm() > EPSILON)
+        return false;
+
+    Vector3f N = normalize(vertex.normal);
+    Intersection sample;
+    float pdf;
+    sampleLight(vertex, sample, pdf);
+
+    Vector3f dl_vec = sample.coords - vertex.coords;
+    Vector3f ws = normalize(dl_vec);
+    float dl_distance = dl_vec.norm();
+    float cos_light = dotProduct(normalize(sample.normal), -ws);
+    float cos_surface = dotProduct(N, ws);
+    if (pdf <= 0.0f || cos_light <= 0.0f || cos_surface <= 0.0f)
+        return false;
+
+    shadow = spawnRayTo(vertex.coords, N, sample.coords, sample.normal, time);
+    contribution = sample.emit * vertex.m->eval(ws, wo, N) *
+        cos_light * cos_surface / (dl_distance * dl_distance * pdf);
+    return true;
+}
+
+// Russian roulette and the BSDF sample at a path vertex reached after depth
+// bounces: false if the path ends there, otherwise ray becomes the next
+// segment (keeping its time) and throughput takes the BSDF weight
+bool Scene::continuePath(const Intersection &vertex, const Vector3f &wo,
+                         int depth, Vector3f &throughput, Ray &ray) const
+{
+    if (maxDepth >= 0 && depth >= maxDepth)
+        return false;
+    if (!russianRoulette(throughput))
+        return false;
 
-    Intersection current = intersect(ray);
-    if (current.emit.norm() > EPSILON) {
-        return Vector3f(fmin(current.emit.x, 1),fmin(current.emit.y, 1),fmin(current.emit.z, 1));
+    Vector3f N = normalize(vertex.normal);
+    Vector3f wi = normalize(vertex.m->sample(wo, N));
+    float wi_pdf = vertex.m->pdf(wi, wo, N);
+    if (wi_pdf <= 0.0f)
+        return false;
+    throughput = throughput * vertex.m->eval(wi, wo, N) *
+        dotProduct(N, wi) / wi_pdf;
+    ray = Ray(offsetRayOrigin(vertex.coords, N, wi), wi, ray.t);
+    return true;
+}
+
+// Continue a path that reached hit along ray after depth bounces, carrying
+// throughput from the camera; returns the radiance it gathers. direct, if
+// given, is the light sample of the first vertex, already traced (see
+// shadePacket).
+Vector3f Scene::tracePath(const Ray &ray, const Intersection &hit, int depth,
+                          Vector3f throughput, const Vector3f *direct)
+{
+    Vector3f radiance(0.0f);
+    Ray current_ray = ray;
+    Intersection current = hit;
+    int vertices = depth;
+
+    for (; current.happened; ++depth) {
+        vertices = depth + 1;
+        // emission is seen directly by camera rays only, later vertices
+        // account for it through light sampling
+        if (current.emit.norm() > EPSILON) {
+            if (depth == 0) {
+                radiance += current.emit;
+            }
+            break;
+        }
+
+        Vector3f wo = normalize(-current_ray.direction);
+        if (direct) {
+            radiance += throughput * *direct;
+            direct = nullptr;
+        } else {
+            Ray shadow = current_ray;
+            Vector3f contribution;
+            if (sampleDirect(current, wo, current_ray.t, shadow, contribution) &&
+                !occluded(shadow)) {
+                radiance += throughput * contribution;
+            }
+        }
+
+        if (!continuePath(current, wo, depth, throughput, current_ray)) {
+            break;
+        }
+        STAT_RAY(BOUNCE, 1);
+        current = intersect(current_ray);
     }
-    if (current.happened) {
-        Vector3f wo = normalize(-ray.direction);
-        // Direct lighting calculation
+
+    STAT_PATH_LENGTH(vertices);
+    return radiance;
+}
+
+static inline float powerHeuristic(float pdf_f, float pdf_g)
+{
+    float f = pdf_f * pdf_f, g = pdf_g * pdf_g;
+    return (f + g) > 0 ? f / (f + g) : 0.0f;
+}
+
+// Implementation of Path Tracing with multiple importance sampling: every
+// vertex takes a light sample and a BSDF sample, and emission reached by
+// either strategy is weighted with the power heuristic
+Vector3f Scene::castRayMIS(const Ray &ray)
+{
+    STAT_RAY(CAMERA, 1);
+    return castRayMIS(ray, intersect(ray));
+}
+
+Vector3f Scene::castRayMIS(const Ray &ray, const Intersection &hit)
+{
+    Vector3f radiance(0.0f), throughput(1.0f);
+    Ray current_ray = ray;
+    Intersection current = hit, previous;
+    float bsdf_pdf = 0.0f;
+    int vertices = 0;
+
+    for (int depth = 0; current.happened; ++depth) {
+        vertices = depth + 1;
+        Vector3f wo = normalize(-current_ray.direction);
+        Vector3f N = normalize(current.normal);
+
+        if (current.emit.norm() > EPSILON) {
+            if (depth == 0) {
+                radiance += current.emit;
+            } else {
+                // BSDF sample that landed on a light
+                float cos_light = dotProduct(N, wo);
+                if (cos_light > 0.0f) {
+                    float light_pdf = pdfLight(previous, current) *
+                        current.distance * current.distance / cos_light;
+                    radiance += throughput * current.emit *
+                        powerHeuristic(bsdf_pdf, light_pdf);
+                }
+            }
+            break;
+        }
+
+        // light sample
         Intersection sample;
         float pdf;
-        sampleLight(sample, pdf);
-        
+        sampleLight(current, sample, pdf);
+
         Vector3f dl_vec = sample.coords - current.coords;
-        
-        Vector3f N = normalize(current.normal);
         Vector3f ws = normalize(dl_vec);
         float dl_distance = dl_vec.norm();
-        Vector3f NN = normalize(sample.normal);
+        float cos_light = dotProduct(normalize(sample.normal), -ws);
+        float cos_surface = dotProduct(N, ws);
 
-        Vector3f p = current.coords;
+        if (pdf > 0.0f && cos_light > 0.0f && cos_surface > 0.0f) {
+            if (!occluded(spawnRayTo(current.coords, N, sample.coords,
+                                     sample.normal, current_ray.t))) {
+                float light_pdf = pdf * dl_distance * dl_distance / cos_light;
+                float brdf_pdf = current.m->pdf(ws, wo, N);
+                radiance += throughput * sample.emit *
+                    current.m->eval(ws, wo, N) * cos_surface *
+                    powerHeuristic(light_pdf, brdf_pdf) / light_pdf;
+            }
+        }
 
-        auto dl_intersection = intersect(Ray(current.coords, ws));
+        if (maxDepth >= 0 && depth >= maxDepth) {
+            break;
+        }
+        if (!russianRoulette(throughput)) {
+            break;
+        }
 
-        Vector3f l_dir(0,0,0);    
-        if (dl_intersection.distance > dl_distance - 0.01) {
-            l_dir = ((sample.emit * current.m->eval(ws, wo, N) * dotProduct(NN, 
-                -ws) * dotProduct(N, ws))/ (dl_distance*dl_distance * pdf));
+        // BSDF sample
+        Vector3f wi = normalize(current.m->sample(wo, N));
+        bsdf_pdf = current.m->pdf(wi, wo, N);
+        if (bsdf_pdf <= 0.0f) {
+            break;
         }
+        throughput = throughput * current.m->eval(wi, wo, N) *
+            dotProduct(N, wi) / bsdf_pdf;
 
-        float random = (rand()%1000)/1000.0f;
+        current_ray = Ray(offsetRayOrigin(current.coords, N, wi), wi,
+                          current_ray.t);
+        previous = current;
+        STAT_RAY(BOUNCE, 1);
+        current = intersect(current_ray);
+    }
 
-        if (random > Scene::RussianRoulette) {
-            return l_dir;
-        }
+    STAT_PATH_LENGTH(vertices);
+    return radiance;
+}
 
-        Vector3f wi = normalize(current.m->sample(wo, N));
-        Vector3f l_indir = castRay(Ray(p,wi),depth+1) * 
-            current.m->eval(wi, wo, N) * 
-            dotProduct(N, wi)/(RussianRoulette * 
-            current.m->pdf(wi, wo, N));
+// Trace a packet of camera rays. The primary hits are found with one packet
+// traversal; for the path tracers the shadow rays of the first vertex all
+// head to the same lights and are traced as a second packet. Each path then
+// continues on its own.
+void Scene::castRayPacket(const RayPacket &packet, Vector3f *radiance)
+{
+    Intersection hits[RayPacket::SIZE];
+    intersectPacket(packet, hits);
+    shadePacket(packet, hits, radiance);
+}
+
+void Scene::intersectPacket(const RayPacket &packet, Intersection *hits)
+{
+    const int SIZE = RayPacket::SIZE;
+#ifdef RAYTRACING_STATS
+    for (int i = 0; i < SIZE; ++i)
+        STAT_RAY(CAMERA, packet.active[i]);
+#endif
+    HitRecord records[SIZE];
+    bvh->IntersectPacket(packet, packet.active, records);
+    for (int i = 0; i < SIZE; ++i)
+        hits[i] = records[i].happened() ?
+            records[i].prim->getSurfaceInteraction(packet.ray(i), records[i]) :
+            Intersection();
+}
+
+// hits[i] must be the closest hit of lane i, the packet is only used for
+// the rays. The light samples of the first vertices are traced as one
+// packet, the rest of each path by tracePath.
+void Scene::shadePacket(const RayPacket &packet, const Intersection *hits,
+                        Vector3f *radiance)
+{
+    const int SIZE = RayPacket::SIZE;
+    for (int i = 0; i < SIZE; ++i)
+        radiance[i] = Vector3f(0.0f);
+
+    if (integrator == Integrator::MIS) {
+        for (int i = 0; i < SIZE; ++i)
+            if (packet.active[i])
+                radiance[i] = castRayMIS(packet.ray(i), hits[i]);
+        return;
+    }
 
-        Vector3f total = l_indir + l_dir;
+    RayPacket shadow;
+    Vector3f direct[SIZE];
+    for (int i = 0; i < SIZE; ++i) {
+        direct[i] = Vector3f(0.0f);
+        if (!packet.active[i] || !hits[i].happened)
+            continue;
+        Ray ray = packet.ray(i);
+        if (sampleDirect(hits[i], normalize(-ray.direction), packet.time, ray,
+                         direct[i]))
+            shadow.set(i, ray);
+    }
+
+    bool blocked[SIZE] = {};
+    bvh->OccludedPacket(shadow, shadow.active, blocked);
 
-        return Vector3f(fmin(total.x, 1), fmin(total.y, 1), fmin(total.z, 1));
+    for (int i = 0; i < SIZE; ++i) {
+        STAT_RAY(SHADOW, shadow.active[i]);
+        if (!shadow.active[i] || blocked[i])
+            direct[i] = Vector3f(0.0f);
+        if (packet.active[i])
+            radiance[i] = tracePath(packet.ray(i), hits[i], 0, Vector3f(1.0f),
+                                    &direct[i]);
     }
-    
-    return Vector3f(0,0,0);
-}
\ No newline at end of file
+}
@@ -10,7 +10,12 @@
 #include "Light.hpp"
 #include "AreaLight.hpp"
 #include "BVH.hpp"
+#include "AliasTable.hpp"
+#include "LightBVH.hpp"
+#include "Stats.hpp"
 #include "Ray.hpp"
+#include "Camera.hpp"
+#include "Topology.hpp"
 
 #include <semaphore.h>
 #include <future>
@@ -31,15 +36,18 @@ public:
 
     class ThreadPool {
     public:
-        const static int THREAD_NUM = 32;
-
         const static int WINDOW_SIZE = 1024;
 
         const static int BUFFER_SIZE = 2048;
 
-        
+        // number of workers, 0 for one per physical core, and whether each
+        // is pinned to a logical CPU (see CpuTopology::placement); read when
+        // the first task is produced
+        int threads = 0;
+        bool pin = false;
+
         // std::mutex p_locks[THREAD_NUM];
-        std::thread consumers [THREAD_NUM];
+        std::vector<std::thread> consumers;
         std::function<void(void)> waitQueue[BUFFER_SIZE];
         int consumer_id = 0;
         int producer_id = 0;
@@ -48,15 +56,20 @@ public:
         
         // std::mutex p_lock,c_lock;
         std::mutex q_lock;
+        std::once_flag started;
         // int nthread_waits = 0;
         std::atomic<bool> terminate = false;
 
-        ThreadPool() {
+        void start() {
+            const CpuTopology &topology = CpuTopology::get();
+            std::vector<int> cpus = topology.placement();
+            int n = threads > 0 ? threads : topology.physicalCores;
+            printf(" - Starting %d render threads%s\n", n, pin ? ", pinned" : "");
 
-            for (int i = 0; i < THREAD_NUM; ++i) {
-                int j = i;
-                consumers[i] = std::thread([&](){
-                    init_random_device();
+            for (int i = 0; i < n; ++i) {
+                int cpu = cpus[i % cpus.size()];
+                consumers.emplace_back([this, cpu](){
+                    if (pin) pinThread(cpu);
                     while(!terminate) {
                         std::function<void(void)> target;
                         {
@@ -76,12 +89,12 @@ public:
                         }
                         target();
                     }
-                    delete_random_device();
                 });
             }
         }
 
         void produce(std::function<void(void)> &&task) {
+            std::call_once(started, [this](){ start(); });
             std::unique_lock<std::mutex> lock(q_lock);
             producer_cv.wait(lock, [&](){
                 int dis = rec_dis(producer_id, consumer_id, BUFFER_SIZE);
@@ -113,11 +126,36 @@ public:
 
     int width = 1280;
     int height = 960;
-    double fov = 40;
+    // views to render, each to its own image
+    std::vector<Camera> cameras = std::vector<Camera>(1);
+    // samples per pixel
+    int spp = 1024;
+    // base of the per-task random seeds, equal seeds give equal images
+    uint32_t seed = 1;
+    // frames of the animation, see SceneLoader::setFrame
+    int frames = 1;
+    // primary hits traced per pixel when its camera rays change between
+    // samples (pixel filter, lens or motion), on a stratified grid and
+    // shared by the samples in turn; 0 traces every sample's own ray.
+    // Pixels whose rays never change always trace their hit once.
+    int primarySamples = 0;
     Vector3f backgroundColor = Vector3f(0.235294, 0.67451, 0.843137);
-    int maxDepth = 1;
+    // maximum number of bounces after the first hit, negative for no limit
+    int maxDepth = 16;
+    // upper bound on the Russian roulette survival probability
     float RussianRoulette = 0.8;
 
+    // light transport algorithm; WAVEFRONT runs the PATH estimator on
+    // batches of rays (see Wavefront.hpp) and is driven by the Renderer
+    enum class Integrator { PATH, MIS, WAVEFRONT };
+    Integrator integrator = Integrator::PATH;
+
+    // how sampleLight chooses an emitter: proportional to power only, or
+    // by descending the light BVH towards lights bright at the shading point
+    enum class LightSampling { POWER, LIGHT_BVH };
+    LightSampling lightSampling = LightSampling::POWER;
+
+    Scene() {}
     Scene(int w, int h) : width(w), height(h) {
         // sem_init(&thread_limiter, 1, THREAD_NUM);
     }
@@ -132,12 +170,55 @@ public:
     const std::vector<Object*>& get_objects() const { return objects; }
     const std::vector<std::unique_ptr<Light> >&  get_lights() const { return lights; }
     Intersection intersect(const Ray& ray) const;
-    BVHAccel *bvh;
+    // closest hit without the surface interaction, enough for visibility
+    bool intersect(const Ray& ray, HitRecord &hit) const;
+    // any hit within the ray's (t_min, t_max), for shadow rays
+    bool occluded(const Ray& ray) const;
+    std::unique_ptr<BVHAccel> bvh;
+    // (re)builds the BVH over objects, freeing the previous one
     void buildBVH();
+    // after objects moved, refits the BVH (rebuilding it if its quality
+    // dropped, see BVHAccel::Update) and the light sampling structures
+    bool updateBVH(float maxCostRatio = 2.0f);
+    // whether anything moves during the shutter interval
+    bool moving() const { return bvh->root && bvh->root->moving; }
+    // a uniformly distributed shutter time for a camera ray, see Ray::t
+    float sampleTime() const;
     
-    Vector3f castRay(const Ray &ray, int depth);
+    Vector3f castPrimaryRay(const Ray &ray);
+    Vector3f castRay(const Ray &ray);
+    Vector3f tracePath(const Ray &ray, const Intersection &hit, int depth,
+                       Vector3f throughput, const Vector3f *direct = nullptr);
+    // the two steps of a path vertex, shared by all path tracers: a light
+    // sample, and the continuation along a BSDF sample
+    bool sampleDirect(const Intersection &vertex, const Vector3f &wo, float time,
+                      Ray &shadow, Vector3f &contribution) const;
+    bool continuePath(const Intersection &vertex, const Vector3f &wo, int depth,
+                      Vector3f &throughput, Ray &ray) const;
+    Vector3f castRayMIS(const Ray &ray);
+    Vector3f castRayMIS(const Ray &ray, const Intersection &hit);
+    // radiance of a packet of coherent camera rays, one value per lane
+    void castRayPacket(const RayPacket &packet, Vector3f *radiance);
+    // the two halves of castRayPacket, so that primary hits can be traced
+    // once and shaded by several samples
+    void intersectPacket(const RayPacket &packet, Intersection *hits);
+    void shadePacket(const RayPacket &packet, const Intersection *hits,
+                     Vector3f *radiance);
+    bool russianRoulette(Vector3f &throughput) const;
 
     void sampleLight(Intersection &pos, float &pdf) const;
+    float pdfLight(const Intersection &pos) const;
+    // light sampling as seen from the shading point ref
+    void sampleLight(const Intersection &ref, Intersection &pos, float &pdf) const;
+    float pdfLight(const Intersection &ref, const Intersection &pos) const;
+
+    // emissive primitives and the power-weighted distribution sampleLight
+    // draws from, rebuilt by buildBVH
+    std::vector<Object*> emitters;
+    std::unordered_map<const Object*, int> emitterIndex;
+    AliasTable emitterTable;
+    LightBVH lightBVH;
+    void buildLights();
     bool trace(const Ray &ray, const std::vector<Object*> &objects, float &tNear, uint32_t &index, Object **hitObject);
     std::tuple<Vector3f, Vector3f> HandleAreaLight(const AreaLight &light, const Vector3f &hitPoint, const Vector3f &N,
                                                    const Vector3f &shadowPointOrig,
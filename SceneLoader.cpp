@@ -0,0 +1,559 @@
+#include "SceneLoader.hpp"
+#include "Triangle.hpp"
+#include "Sphere.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <sstream>
+
+namespace {
+
+std::vector<std::string> tokenize(const std::string &line)
+{
+    std::istringstream in(line.substr(0, line.find('#')));
+    std::vector<std::string> tokens;
+    std::string token;
+    while (in >> token)
+        tokens.push_back(token);
+    return tokens;
+}
+
+bool parseFloat(const std::string &s, float &f)
+{
+    try {
+        size_t used;
+        f = std::stof(s, &used);
+        return used == s.size();
+    } catch (const std::exception &) {
+        return false;
+    }
+}
+
+// one value for all three components, or three values
+bool parseVector(const std::vector<std::string> &args, Vector3f &v)
+{
+    float x, y, z;
+    if (args.size() == 1 && parseFloat(args[0], x)) {
+        v = Vector3f(x);
+        return true;
+    }
+    if (args.size() == 3 && parseFloat(args[0], x) && parseFloat(args[1], y) &&
+        parseFloat(args[2], z)) {
+        v = Vector3f(x, y, z);
+        return true;
+    }
+    return false;
+}
+
+bool parseScalar(const std::vector<std::string> &args, float &f)
+{
+    return args.size() == 1 && parseFloat(args[0], f);
+}
+
+bool parseFilter(const std::vector<std::string> &args, Camera::Filter &filter)
+{
+    if (args.size() != 1)
+        return false;
+    if (args[0] == "none") filter = Camera::Filter::NONE;
+    else if (args[0] == "box") filter = Camera::Filter::BOX;
+    else if (args[0] == "tent") filter = Camera::Filter::TENT;
+    else if (args[0] == "gaussian") filter = Camera::Filter::GAUSSIAN;
+    else return false;
+    return true;
+}
+
+bool sameVector(const Vector3f &a, const Vector3f &b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+} // namespace
+
+// file and placement of a mesh, exact to the bit
+std::string SceneLoader::placementKey(const ObjectDesc &desc)
+{
+    std::ostringstream key;
+    key << desc.path << std::hexfloat;
+    for (const Vector3f &v : {desc.start.translate, desc.start.scale, desc.start.rotate})
+        key << ' ' << v.x << ' ' << v.y << ' ' << v.z;
+    return key.str();
+}
+
+bool SceneLoader::MaterialDesc::operator==(const MaterialDesc &other) const
+{
+    return type == other.type && sameVector(emission, other.emission) &&
+           sameVector(kd, other.kd) && sameVector(ks, other.ks) &&
+           sameVector(f0, other.f0) && ior == other.ior &&
+           diffuseFactor == other.diffuseFactor &&
+           roughness == other.roughness && alpha == other.alpha &&
+           metallic == other.metallic;
+}
+
+bool SceneLoader::parseMaterialKey(const std::string &key,
+                                   const std::vector<std::string> &args,
+                                   MaterialDesc &desc, std::string &error)
+{
+    bool ok;
+    if (key == "type") {
+        ok = args.size() == 1 && (args[0] == "diffuse" || args[0] == "microfacet");
+        if (ok) desc.type = args[0] == "diffuse" ? DIFFUSE : MICROFACET;
+    } else if (key == "emission") {
+        ok = parseVector(args, desc.emission);
+    } else if (key == "kd") {
+        ok = parseVector(args, desc.kd);
+    } else if (key == "ks") {
+        ok = parseVector(args, desc.ks);
+    } else if (key == "f0") {
+        ok = parseVector(args, desc.f0);
+    } else if (key == "ior") {
+        ok = parseScalar(args, desc.ior);
+    } else if (key == "diffuse_factor") {
+        ok = parseScalar(args, desc.diffuseFactor);
+    } else if (key == "roughness") {
+        ok = parseScalar(args, desc.roughness);
+    } else if (key == "alpha") {
+        ok = parseScalar(args, desc.alpha);
+    } else if (key == "metallic") {
+        ok = parseScalar(args, desc.metallic);
+    } else {
+        error = "unknown material key '" + key + "'";
+        return false;
+    }
+    if (!ok)
+        error = "bad value for '" + key + "'";
+    return ok;
+}
+
+void SceneLoader::setMaterial(const MaterialDesc &desc, Material &m)
+{
+    m = Material(desc.type, desc.emission);
+    m.Kd = desc.kd;
+    m.Ks = desc.ks;
+    m.f0 = desc.f0;
+    m.ior = desc.ior;
+    m.diffuseFactor = desc.diffuseFactor;
+    m.roughness = desc.roughness;
+    m.h_alpha = desc.alpha;
+    m.metallic = desc.metallic;
+}
+
+size_t SceneLoader::addMaterial(const std::string &name, const MaterialDesc &desc)
+{
+    auto it = materialIndex.find(name);
+    if (it != materialIndex.end())
+        return it->second;
+
+    // names with identical parameters share one Material
+    size_t k = 0;
+    while (k < materialDescs.size() && !(materialDescs[k] == desc))
+        ++k;
+    if (k == materialDescs.size()) {
+        auto m = std::make_unique<Material>();
+        setMaterial(desc, *m);
+        materialDescs.push_back(desc);
+        materials.push_back(std::move(m));
+    }
+    materialIndex[name] = k;
+    return k;
+}
+
+size_t SceneLoader::unshareMaterial(const std::string &name)
+{
+    size_t k = materialIndex.at(name);
+    size_t users = 0;
+    for (const auto &entry : materialIndex)
+        users += entry.second == k;
+    if (users == 1)
+        return k;
+
+    materialDescs.push_back(materialDescs[k]);
+    materials.push_back(std::make_unique<Material>(*materials[k]));
+    k = materials.size() - 1;
+    materialIndex[name] = k;
+    Material *m = materials[k].get();
+    for (size_t i = 0; i < objects.size(); ++i) {
+        if (loadedDescs[i].material != name)
+            continue;
+        if (loadedDescs[i].sphere)
+            static_cast<Sphere*>(objects[i].get())->m = m;
+        else
+            static_cast<MeshTriangle*>(objects[i].get())->setMaterial(m);
+    }
+    return k;
+}
+
+bool SceneLoader::editMaterial(Scene &scene, const std::string &name,
+                               const std::string &key,
+                               const std::vector<std::string> &args,
+                               std::string &error)
+{
+    auto it = materialIndex.find(name);
+    if (it == materialIndex.end()) {
+        error = "no object uses material '" + name + "'";
+        return false;
+    }
+    MaterialDesc desc = materialDescs[it->second];
+    if (!parseMaterialKey(key, args, desc, error))
+        return false;
+    if (movingMaterials.count(name) && !sameVector(desc.emission, Vector3f(0.0f))) {
+        error = "lights cannot have motion";
+        return false;
+    }
+
+    bool emissionChanged = !sameVector(desc.emission,
+                                       materialDescs[it->second].emission);
+    size_t k = unshareMaterial(name);
+    materialDescs[k] = desc;
+    setMaterial(desc, *materials[k]);
+    // the emitters and their power weights depend on the emission only
+    if (emissionChanged)
+        scene.buildLights();
+    return true;
+}
+
+bool SceneLoader::load(const std::string &path, Scene &scene)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << path << ": cannot open scene file\n";
+        return false;
+    }
+    std::filesystem::path dir = std::filesystem::path(path).parent_path();
+
+    int lineNo = 0;
+    auto fail = [&](int line, const std::string &message) {
+        std::cerr << path << ":" << line << ": " << message << "\n";
+        return false;
+    };
+
+    enum class Block { NONE, MATERIAL, OBJECT, CAMERA };
+    Block block = Block::NONE;
+    std::unordered_map<std::string, MaterialDesc> namedMaterials;
+    std::string materialName;
+    MaterialDesc material;
+    ObjectDesc object;
+    // the _end keys given in the current object block
+    std::vector<std::string> endKeys;
+    std::vector<ObjectDesc> objectDescs;
+    // the camera set up by the top level keys, looking along +z, and the
+    // camera blocks; each at the first and the last frame
+    Camera defaultCamera, defaultCameraEnd;
+    bool eyeAnimated = false;
+    Camera camera, cameraBlockEnd;
+    std::vector<std::string> cameraEndKeys;
+
+    std::string text;
+    while (std::getline(file, text)) {
+        ++lineNo;
+        std::vector<std::string> tokens = tokenize(text);
+        if (tokens.empty())
+            continue;
+        const std::string &key = tokens[0];
+        std::vector<std::string> args(tokens.begin() + 1, tokens.end());
+        auto badValue = [&]() { return fail(lineNo, "bad value for '" + key + "'"); };
+        float f;
+        Vector3f v;
+
+        if (block == Block::NONE) {
+            if (key == "resolution") {
+                float w, h;
+                if (args.size() != 2 || !parseFloat(args[0], w) ||
+                    !parseFloat(args[1], h) || w < 1 || h < 1)
+                    return badValue();
+                scene.width = int(w);
+                scene.height = int(h);
+            } else if (key == "spp") {
+                if (!parseScalar(args, f) || f < 1) return badValue();
+                scene.spp = int(f);
+            } else if (key == "fov") {
+                if (!parseScalar(args, f)) return badValue();
+                defaultCamera.fov = f;
+            } else if (key == "eye") {
+                if (args.size() != 3 || !parseVector(args, v)) return badValue();
+                defaultCamera.eye = v;
+            } else if (key == "eye_end") {
+                if (args.size() != 3 || !parseVector(args, v)) return badValue();
+                defaultCameraEnd.eye = v;
+                eyeAnimated = true;
+            } else if (key == "camera") {
+                if (args.size() != 1) return badValue();
+                for (const Camera &c : cameraStart)
+                    if (c.name == args[0])
+                        return fail(lineNo, "camera '" + args[0] + "' defined twice");
+                block = Block::CAMERA;
+                camera = Camera();
+                camera.name = args[0];
+                cameraEndKeys.clear();
+            } else if (key == "frames") {
+                if (!parseScalar(args, f) || f < 1) return badValue();
+                scene.frames = int(f);
+            } else if (key == "max_depth") {
+                if (!parseScalar(args, f)) return badValue();
+                scene.maxDepth = int(f);
+            } else if (key == "primary_samples") {
+                if (!parseScalar(args, f) || f < 0) return badValue();
+                scene.primarySamples = int(f);
+            } else if (key == "seed") {
+                if (!parseScalar(args, f) || f < 0) return badValue();
+                scene.seed = uint32_t(f);
+            } else if (key == "material") {
+                if (args.size() != 1) return badValue();
+                if (namedMaterials.count(args[0]))
+                    return fail(lineNo, "material '" + args[0] + "' defined twice");
+                block = Block::MATERIAL;
+                materialName = args[0];
+                material = MaterialDesc();
+            } else if (key == "mesh") {
+                if (args.size() != 1) return badValue();
+                block = Block::OBJECT;
+                object = ObjectDesc();
+                endKeys.clear();
+                object.path = (dir / args[0]).string();
+                object.line = lineNo;
+            } else if (key == "sphere") {
+                if (!args.empty()) return badValue();
+                block = Block::OBJECT;
+                object = ObjectDesc();
+                endKeys.clear();
+                object.sphere = true;
+                object.line = lineNo;
+            } else {
+                return fail(lineNo, "unknown keyword '" + key + "'");
+            }
+        } else if (key == "end") {
+            if (block == Block::MATERIAL) {
+                namedMaterials[materialName] = material;
+            } else if (block == Block::CAMERA) {
+                Camera end = camera;
+                for (const std::string &endKey : cameraEndKeys) {
+                    if (endKey == "eye_end") end.eye = cameraBlockEnd.eye;
+                    else if (endKey == "look_at_end") end.lookAt = cameraBlockEnd.lookAt;
+                }
+                cameraStart.push_back(camera);
+                cameraEnd.push_back(end);
+            } else {
+                // whatever has no _end value does not move
+                Placement end = object.start;
+                for (const std::string &endKey : endKeys) {
+                    if (endKey == "translate_end") end.translate = object.end.translate;
+                    else if (endKey == "scale_end") end.scale = object.end.scale;
+                    else if (endKey == "rotate_end") end.rotate = object.end.rotate;
+                    else if (endKey == "center_end") end.center = object.end.center;
+                }
+                object.end = end;
+                object.animated = !endKeys.empty();
+                objectDescs.push_back(object);
+            }
+            block = Block::NONE;
+        } else if (block == Block::CAMERA) {
+            if (key == "eye") {
+                if (args.size() != 3 || !parseVector(args, camera.eye)) return badValue();
+            } else if (key == "look_at") {
+                if (args.size() != 3 || !parseVector(args, camera.lookAt)) return badValue();
+            } else if (key == "up") {
+                if (args.size() != 3 || !parseVector(args, camera.up)) return badValue();
+            } else if (key == "eye_end") {
+                if (args.size() != 3 || !parseVector(args, cameraBlockEnd.eye)) return badValue();
+                cameraEndKeys.push_back(key);
+            } else if (key == "look_at_end") {
+                if (args.size() != 3 || !parseVector(args, cameraBlockEnd.lookAt)) return badValue();
+                cameraEndKeys.push_back(key);
+            } else if (key == "fov") {
+                if (!parseScalar(args, f)) return badValue();
+                camera.fov = f;
+            } else if (key == "aperture") {
+                if (!parseScalar(args, camera.lensRadius) || camera.lensRadius < 0)
+                    return badValue();
+            } else if (key == "focus_distance") {
+                if (!parseScalar(args, camera.focusDistance)) return badValue();
+            } else if (key == "filter") {
+                if (!parseFilter(args, camera.filter)) return badValue();
+            } else {
+                return fail(lineNo, "unknown camera key '" + key + "'");
+            }
+        } else if (block == Block::MATERIAL) {
+            std::string error;
+            if (!parseMaterialKey(key, args, material, error))
+                return fail(lineNo, error);
+        } else {
+            if (key == "material") {
+                if (args.size() != 1) return badValue();
+                object.material = args[0];
+            } else if (!object.sphere && key == "translate") {
+                if (!parseVector(args, object.start.translate)) return badValue();
+            } else if (!object.sphere && key == "scale") {
+                if (!parseVector(args, object.start.scale)) return badValue();
+            } else if (!object.sphere && key == "rotate") {
+                if (!parseVector(args, object.start.rotate)) return badValue();
+            } else if (!object.sphere && key == "translate_end") {
+                if (!parseVector(args, object.end.translate)) return badValue();
+                endKeys.push_back(key);
+            } else if (!object.sphere && key == "scale_end") {
+                if (!parseVector(args, object.end.scale)) return badValue();
+                endKeys.push_back(key);
+            } else if (!object.sphere && key == "rotate_end") {
+                if (!parseVector(args, object.end.rotate)) return badValue();
+                endKeys.push_back(key);
+            } else if (object.sphere && key == "center") {
+                if (args.size() != 3 || !parseVector(args, object.start.center)) return badValue();
+            } else if (object.sphere && key == "center_end") {
+                if (args.size() != 3 || !parseVector(args, object.end.center)) return badValue();
+                endKeys.push_back(key);
+            } else if (key == "motion") {
+                if (args.size() != 3 || !parseVector(args, object.motion)) return badValue();
+            } else if (object.sphere && key == "radius") {
+                if (!parseScalar(args, object.radius)) return badValue();
+            } else {
+                return fail(lineNo, "unknown key '" + key + "'");
+            }
+        }
+    }
+    if (block != Block::NONE)
+        return fail(lineNo, "missing 'end'");
+    if (cameraStart.empty()) {
+        defaultCamera.lookAt = defaultCamera.eye + Vector3f(0, 0, 1);
+        Vector3f eyeEnd = eyeAnimated ? defaultCameraEnd.eye : defaultCamera.eye;
+        defaultCameraEnd = defaultCamera;
+        defaultCameraEnd.eye = eyeEnd;
+        defaultCameraEnd.lookAt = eyeEnd + Vector3f(0, 0, 1);
+        cameraStart.push_back(defaultCamera);
+        cameraEnd.push_back(defaultCameraEnd);
+    }
+    scene.cameras = cameraStart;
+
+    // materials are created only once an object uses them
+    std::vector<Material*> objectMaterials;
+    for (const ObjectDesc &desc : objectDescs) {
+        auto it = namedMaterials.find(desc.material);
+        if (it == namedMaterials.end())
+            return fail(desc.line, "undefined material '" + desc.material + "'");
+        if (!sameVector(desc.motion, Vector3f(0.0f)) &&
+            !sameVector(it->second.emission, Vector3f(0.0f)))
+            return fail(desc.line, "lights cannot have motion");
+        size_t k = addMaterial(desc.material, it->second);
+        objectMaterials.push_back(materials[k].get());
+        if (!sameVector(desc.motion, Vector3f(0.0f)))
+            movingMaterials.insert(desc.material);
+    }
+
+    // read each OBJ file once, all files in parallel
+    using MeshFuture = AssetCache::MeshFuture;
+    using ObjectFuture = AssetCache::ObjectFuture;
+    std::unordered_map<std::string, MeshFuture> localFiles;
+    auto &meshFiles = cache ? cache->meshFiles : localFiles;
+    for (const ObjectDesc &desc : objectDescs) {
+        if (desc.sphere || meshFiles.count(desc.path))
+            continue;
+        meshFiles[desc.path] = std::async(std::launch::async, [path = desc.path]() {
+            objl::Loader loader;
+            if (!loader.LoadFile(path) || loader.LoadedMeshes.size() != 1)
+                return std::shared_ptr<objl::Mesh>();
+            return std::make_shared<objl::Mesh>(std::move(loader.LoadedMeshes[0]));
+        }).share();
+    }
+
+    // then transform the meshes and build their BVHs, also in parallel
+    std::vector<ObjectFuture> built;
+    // the cache keys of the meshes taken from or added to the cache; a
+    // second mesh with the same placement in this scene needs its own copy
+    std::vector<std::string> cacheKeys(objectDescs.size());
+    for (size_t i = 0; i < objectDescs.size(); ++i) {
+        const ObjectDesc &desc = objectDescs[i];
+        Material *m = objectMaterials[i];
+        if (desc.sphere) {
+            auto object = std::make_shared<Sphere>(desc.start.center, desc.radius, m);
+            object->motion = desc.motion;
+            std::promise<std::shared_ptr<Object>> sphere;
+            sphere.set_value(std::move(object));
+            built.push_back(sphere.get_future().share());
+            continue;
+        }
+
+        bool shareable = cache && !desc.animated &&
+            sameVector(desc.motion, Vector3f(0.0f));
+        std::string key = shareable ? placementKey(desc) : std::string();
+        if (shareable && std::find(cacheKeys.begin(), cacheKeys.end(), key) == cacheKeys.end()) {
+            cacheKeys[i] = key;
+            auto it = cache->placedMeshes.find(key);
+            if (it != cache->placedMeshes.end()) {
+                built.push_back(it->second);
+                continue;
+            }
+        }
+        ObjectFuture object = std::async(std::launch::async,
+            [desc, m, meshFile = meshFiles.at(desc.path)]() -> std::shared_ptr<Object> {
+                std::shared_ptr<objl::Mesh> mesh = meshFile.get();
+                if (!mesh)
+                    return nullptr;
+                auto object = std::make_shared<MeshTriangle>(*mesh, desc.path, m,
+                    desc.start.translate, desc.start.scale, desc.start.rotate);
+                if (!sameVector(desc.motion, Vector3f(0.0f)))
+                    object->setMotion(desc.motion);
+                return object;
+            }).share();
+        if (!cacheKeys[i].empty())
+            cache->placedMeshes[cacheKeys[i]] = object;
+        built.push_back(object);
+    }
+
+    // objects are added in file order, so the scene BVH does not depend on
+    // which load finished first
+    bool ok = true;
+    for (size_t i = 0; i < built.size(); ++i) {
+        std::shared_ptr<Object> obj = built[i].get();
+        if (!obj) {
+            ok = fail(objectDescs[i].line, "cannot load mesh '" + objectDescs[i].path + "'");
+            // a file that failed is tried again by the next scene
+            if (cache) {
+                cache->meshFiles.erase(objectDescs[i].path);
+                cache->placedMeshes.erase(cacheKeys[i]);
+            }
+            continue;
+        }
+        // a cached mesh still has the material of the scene that built it
+        if (!cacheKeys[i].empty())
+            static_cast<MeshTriangle*>(obj.get())->setMaterial(objectMaterials[i]);
+        scene.Add(obj.get());
+        if (objectDescs[i].animated) {
+            std::shared_ptr<objl::Mesh> mesh;
+            if (!objectDescs[i].sphere)
+                mesh = meshFiles.at(objectDescs[i].path).get();
+            animated.push_back({objectDescs[i], obj.get(), mesh});
+        }
+        objects.push_back(std::move(obj));
+        loadedDescs.push_back(objectDescs[i]);
+    }
+    return ok;
+}
+
+void SceneLoader::setFrame(Scene &scene, int frame)
+{
+    float time = scene.frames > 1 ? frame / float(scene.frames - 1) : 0.0f;
+    for (size_t i = 0; i < scene.cameras.size(); ++i) {
+        scene.cameras[i].eye = lerp(cameraStart[i].eye, cameraEnd[i].eye, time);
+        scene.cameras[i].lookAt = lerp(cameraStart[i].lookAt, cameraEnd[i].lookAt, time);
+    }
+
+    // meshes are transformed in parallel, as when they were loaded
+    std::vector<std::future<void>> updates;
+    for (const AnimatedObject &a : animated) {
+        const Placement &start = a.desc.start, &end = a.desc.end;
+        if (a.desc.sphere) {
+            static_cast<Sphere*>(a.object)->center = lerp(start.center, end.center, time);
+            continue;
+        }
+        updates.push_back(std::async(std::launch::async, [&a, &start, &end, time]() {
+            static_cast<MeshTriangle*>(a.object)->setVertices(
+                MeshTriangle::transformVertices(*a.mesh,
+                    lerp(start.translate, end.translate, time),
+                    lerp(start.scale, end.scale, time),
+                    lerp(start.rotate, end.rotate, time)));
+        }));
+    }
+    for (auto &update : updates)
+        update.get();
+
+    if (!animated.empty())
+        scene.updateBVH();
+}
@@ -0,0 +1,192 @@
+#ifndef RAYTRACING_SCENELOADER_H
+#define RAYTRACING_SCENELOADER_H
+
+#include <future>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "Scene.hpp"
+#include "Material.hpp"
+
+namespace objl { struct Mesh; }
+
+// Reads a scene description file into a Scene. The format is line based,
+// '#' starts a comment:
+//
+//   resolution 784 784         image size
+//   spp 1024                   samples per pixel
+//   fov 40                     vertical field of view in degrees
+//   eye 278 273 -800           camera position, looking along +z
+//   max_depth 16               optional, see Scene::maxDepth
+//   seed 1                     optional, see Scene::seed
+//   primary_samples 16         optional, see Scene::primarySamples
+//   frames 36                  optional, frames of the animation
+//   eye_end 278 273 -600       optional, camera position at the last frame
+//
+//   camera front               optional named views, each rendered to
+//     eye 278 273 -800         its own image; they replace the camera
+//     look_at 278 273 0        of the top level eye and fov
+//     up 0 1 0
+//     fov 40
+//     aperture 10              lens radius, 0 for a pinhole
+//     focus_distance 800       distance of the plane in focus along the view
+//     filter box               none | box | tent | gaussian: jitters
+//     eye_end 400 273 -780     the samples of a pixel; optional eye_end,
+//   end                        look_at_end: placement at the last frame
+//
+//   material white             a named material, the keys inside are
+//     type diffuse             diffuse | microfacet
+//     kd 0.725 0.71 0.68       kd, ks, f0, emission: one value or three
+//     roughness 1.0            ior, diffuse_factor, roughness, alpha,
+//   end                        metallic: one value
+//
+//   mesh ../models/teapot/teapot.obj
+//     material mirror
+//     translate 186 166 169    translate, scale, rotate (degrees): one
+//     scale 30                 value or three
+//     rotate_end 0 360 0       optional translate_end, scale_end,
+//                              rotate_end: placement at the last frame
+//     motion 0 0 20            optional, displacement while the shutter
+//   end                        is open, for motion blur
+//
+//   sphere
+//     center 300 100 300
+//     center_end 300 200 300   optional
+//     motion 0 0 20            optional
+//     radius 100
+//     material mirror
+//   end
+//
+// Animated values are interpolated linearly from the first to the last
+// frame; values without an _end key stay fixed. Lights cannot have motion,
+// light sampling only knows where they are when the shutter opens.
+//
+// Mesh paths are relative to the scene file. Meshes are only read once
+// the whole file has been parsed: each OBJ file is loaded once however
+// many meshes place it, and files and per-mesh BVHs are built in parallel.
+// Materials with identical parameters are shared, under any names.
+//
+// The loader owns the materials and objects it creates, so it has to
+// outlive the render.
+class SceneLoader
+{
+public:
+    class AssetCache;
+
+    // With a cache, OBJ files and static meshes (with their BVHs) are
+    // taken from and added to it instead of being read and built again.
+    explicit SceneLoader(std::shared_ptr<AssetCache> cache = nullptr)
+        : cache(std::move(cache)) {}
+
+    // false, with the error printed to std::cerr, if the file is malformed
+    // or a mesh cannot be loaded. The scene is set up for the first frame.
+    bool load(const std::string &path, Scene &scene);
+
+    // Moves the camera and the animated objects to where they are at frame
+    // (of scene.frames) and refits the BVHs. Meshes, materials and BVH
+    // memory are reused, only vertex positions and bounds are updated.
+    void setFrame(Scene &scene, int frame);
+
+    // Sets key of the named material to args, as in its material block,
+    // in place: objects and BVHs are kept and the light sampling is only
+    // rebuilt if the emission changed. A Material shared with other names
+    // is copied first, so that only this name changes. false, with error
+    // set, if no object uses the material or the key or value is bad.
+    bool editMaterial(Scene &scene, const std::string &name,
+                      const std::string &key,
+                      const std::vector<std::string> &args, std::string &error);
+
+private:
+    struct MaterialDesc {
+        MaterialType type = DIFFUSE;
+        Vector3f emission = Vector3f(0.0f);
+        Vector3f kd = Vector3f(0.0f), ks = Vector3f(0.0f);
+        Vector3f f0 = Vector3f(0.04f);
+        float ior = 1.0f;
+        float diffuseFactor = 1.0f;
+        float roughness = 1.0f;
+        float alpha = 1.0f;
+        float metallic = 0.0f;
+
+        bool operator==(const MaterialDesc &other) const;
+    };
+
+    // placement of an object
+    struct Placement {
+        Vector3f translate = Vector3f(0.0f);
+        Vector3f scale = Vector3f(1.0f);
+        Vector3f rotate = Vector3f(0.0f);
+        Vector3f center = Vector3f(0.0f);
+    };
+
+    struct ObjectDesc {
+        bool sphere = false;
+        std::string path;
+        std::string material;
+        // at the first and the last frame
+        Placement start, end;
+        bool animated = false;
+        Vector3f motion = Vector3f(0.0f);
+        float radius = 1.0f;
+        int line = 0;
+    };
+
+    // an object that moves between frames, with the mesh it was built from
+    struct AnimatedObject {
+        ObjectDesc desc;
+        Object *object;
+        std::shared_ptr<objl::Mesh> mesh;
+    };
+
+    // sets key of a material block in desc, false with error set if the
+    // key is unknown or its value malformed
+    static bool parseMaterialKey(const std::string &key,
+                                 const std::vector<std::string> &args,
+                                 MaterialDesc &desc, std::string &error);
+    static void setMaterial(const MaterialDesc &desc, Material &m);
+    // the index in materials of the named material, created on first use
+    // unless another name has the same parameters
+    size_t addMaterial(const std::string &name, const MaterialDesc &desc);
+    // gives name its own copy of its Material if other names share it,
+    // moving its objects over; the index of name's Material
+    size_t unshareMaterial(const std::string &name);
+    static std::string placementKey(const ObjectDesc &desc);
+
+    std::vector<MaterialDesc> materialDescs;
+    std::vector<std::unique_ptr<Material>> materials;
+    // the names of the materials objects with motion use
+    std::unordered_set<std::string> movingMaterials;
+    // the index in materials of each named material in use
+    std::unordered_map<std::string, size_t> materialIndex;
+    std::vector<std::shared_ptr<Object>> objects;
+    // the description each of objects was created from
+    std::vector<ObjectDesc> loadedDescs;
+    std::shared_ptr<AssetCache> cache;
+    std::vector<AnimatedObject> animated;
+    // the scene's cameras at the first and the last frame
+    std::vector<Camera> cameraStart, cameraEnd;
+};
+
+// Meshes shared by the scenes a long running process loads: each OBJ file
+// is read once, and each placement of it (file, translation, scale and
+// rotation) is transformed and gets its BVH once. Animated and moving
+// meshes are changed by the render and never shared. A shared mesh takes
+// the material of the scene using it, so scenes using the cache have to
+// be loaded and rendered one at a time. Entries live as long as the cache.
+class SceneLoader::AssetCache
+{
+public:
+    size_t files() const { return meshFiles.size(); }
+    size_t meshes() const { return placedMeshes.size(); }
+
+private:
+    friend class SceneLoader;
+    using MeshFuture = std::shared_future<std::shared_ptr<objl::Mesh>>;
+    using ObjectFuture = std::shared_future<std::shared_ptr<Object>>;
+    std::unordered_map<std::string, MeshFuture> meshFiles;
+    std::unordered_map<std::string, ObjectFuture> placedMeshes;
+};
+
+#endif //RAYTRACING_SCENELOADER_H
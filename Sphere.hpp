@@ -13,27 +13,28 @@
 class Sphere : public Object{
 public:
     Vector3f center;
+    // displacement of the center over the shutter interval
+    Vector3f motion = Vector3f(0.0f);
     float radius, radius2;
     Material *m;
     float area;
     Sphere(const Vector3f &c, const float &r, Material* mt = new Material()) : center(c), radius(r), radius2(r * r), m(mt), area(4 * M_PI *r *r) {}
     bool intersect(const Ray& ray) {
         // analytic solution
-        Vector3f L = ray.origin - center;
+        Vector3f L = ray.origin - centerAt(ray.t);
         float a = dotProduct(ray.direction, ray.direction);
         float b = 2 * dotProduct(ray.direction, L);
         float c = dotProduct(L, L) - radius2;
         float t0, t1;
-        float area = 4 * M_PI * radius2;
         if (!solveQuadratic(a, b, c, t0, t1)) return false;
-        if (t0 < 0) t0 = t1;
-        if (t0 < 0) return false;
-        return true;
+        float t_min = std::max(ray.t_min, 1000*EPSILON);
+        if (t0 < t_min) t0 = t1;
+        return t0 >= t_min && t0 < ray.t_max;
     }
     bool intersect(const Ray& ray, float &tnear, uint32_t &index) const
     {
         // analytic solution
-        Vector3f L = ray.origin - center;
+        Vector3f L = ray.origin - centerAt(ray.t);
         float a = dotProduct(ray.direction, ray.direction);
         float b = 2 * dotProduct(ray.direction, L);
         float c = dotProduct(L, L) - radius2;
@@ -46,26 +47,31 @@ public:
 
         return true;
     }
-    Intersection getIntersection(Ray ray){
-        Intersection result;
-        result.happened = false;
-        Vector3f L = ray.origin - center;
+    bool intersect(const Ray& ray, HitRecord &hit){
+        Vector3f L = ray.origin - centerAt(ray.t);
         float a = dotProduct(ray.direction, ray.direction);
         float b = 2 * dotProduct(ray.direction, L);
         float c = dotProduct(L, L) - radius2;
         float t0, t1;
-        if (!solveQuadratic(a, b, c, t0, t1)) return result;
-        if (t0 < 1000*EPSILON) t0 = t1;
-        if (t0 < 1000*EPSILON) return result;
+        if (!solveQuadratic(a, b, c, t0, t1)) return false;
+        // the quadratic loses more precision than the origin offset covers
+        float t_min = std::max(ray.t_min, 1000*EPSILON);
+        if (t0 < t_min) t0 = t1;
+        if (t0 < t_min || t0 >= hit.t) return false;
+        hit.t = t0;
+        hit.prim = this;
+        return true;
+    }
+    Intersection getSurfaceInteraction(const Ray &ray, const HitRecord &hit){
+        Intersection result;
         result.happened=true;
-
-        result.coords = Vector3f(ray.origin + ray.direction * t0);
-        result.normal = normalize(Vector3f(result.coords - center));
+        result.coords = Vector3f(ray.origin + ray.direction * hit.t);
+        result.normal = normalize(Vector3f(result.coords - centerAt(ray.t)));
+        result.emit = m->getEmission();
         result.m = this->m;
         result.obj = this;
-        result.distance = t0;
+        result.distance = hit.t;
         return result;
-
     }
     void getSurfaceProperties(const Vector3f &P, const Vector3f &I, const uint32_t &index, const Vector2f &uv, Vector3f &N, Vector2f &st) const
     { N = normalize(P - center); }
@@ -77,6 +83,12 @@ public:
         return Bounds3(Vector3f(center.x-radius, center.y-radius, center.z-radius),
                        Vector3f(center.x+radius, center.y+radius, center.z+radius));
     }
+    Bounds3 getEndBounds(){
+        Vector3f c = center + motion;
+        return Bounds3(Vector3f(c.x-radius, c.y-radius, c.z-radius),
+                       Vector3f(c.x+radius, c.y+radius, c.z+radius));
+    }
+    Vector3f centerAt(float time) const { return center + motion * time; }
     void Sample(Intersection &pos, float &pdf){
         float theta = 2.0 * M_PI * get_random_float(), phi = M_PI * get_random_float();
         Vector3f dir(std::cos(phi), std::sin(phi)*std::cos(theta), std::sin(phi)*std::sin(theta));
@@ -91,6 +103,9 @@ public:
     bool hasEmit(){
         return m->hasEmission();
     }
+    Vector3f getEmission(){
+        return m->getEmission();
+    }
 };
 
 
@@ -0,0 +1,127 @@
+#include "Stats.hpp"
+#include "MemoryArena.hpp"
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+std::mutex statsLock;
+std::vector<std::unique_ptr<StatCounters>> threadCounters;
+double stageSeconds[Stats::NUM_STAGES] = {};
+
+const char* rayTypeNames[StatCounters::NUM_RAY_TYPES] = {"camera", "shadow", "bounce"};
+const char* stageNames[Stats::NUM_STAGES] = {"load", "build", "render", "output"};
+
+double perSecond(uint64_t n, double seconds)
+{
+    return seconds > 0 ? n / seconds : 0.0;
+}
+
+double ratio(uint64_t n, uint64_t d)
+{
+    return d > 0 ? n / double(d) : 0.0;
+}
+
+} // namespace
+
+void StatCounters::add(const StatCounters &other)
+{
+    for (int i = 0; i < NUM_RAY_TYPES; ++i)
+        rays[i] += other.rays[i];
+    nodeVisits += other.nodeVisits;
+    triangleTests += other.triangleTests;
+    for (int i = 0; i <= MAX_PATH_LENGTH; ++i)
+        pathLength[i] += other.pathLength[i];
+}
+
+// counters outlive their thread, so that work of the finished threads
+// still shows in the totals
+StatCounters* Stats::registerThread()
+{
+    std::lock_guard<std::mutex> lock(statsLock);
+    threadCounters.push_back(std::make_unique<StatCounters>());
+    return threadCounters.back().get();
+}
+
+StatCounters Stats::total()
+{
+    std::lock_guard<std::mutex> lock(statsLock);
+    StatCounters sum;
+    for (auto &counters : threadCounters)
+        sum.add(*counters);
+    return sum;
+}
+
+void Stats::addTime(Stage stage, double seconds)
+{
+    std::lock_guard<std::mutex> lock(statsLock);
+    stageSeconds[stage] += seconds;
+}
+
+void Stats::print(std::ostream &os)
+{
+    StatCounters sum = total();
+    double renderSeconds = stageSeconds[RENDER];
+    uint64_t rays = 0, paths = 0, vertices = 0;
+    for (int i = 0; i < StatCounters::NUM_RAY_TYPES; ++i)
+        rays += sum.rays[i];
+    for (int i = 0; i <= StatCounters::MAX_PATH_LENGTH; ++i) {
+        paths += sum.pathLength[i];
+        vertices += i * sum.pathLength[i];
+    }
+
+    os << "Render statistics:\n";
+    for (int i = 0; i < StatCounters::NUM_RAY_TYPES; ++i)
+        os << "  " << rayTypeNames[i] << " rays: " << sum.rays[i] << "\n";
+    os << "  rays/s: " << perSecond(rays, renderSeconds) / 1e6 << " M\n";
+    os << "  BVH nodes visited: " << sum.nodeVisits << " ("
+       << ratio(sum.nodeVisits, rays) << " per ray)\n";
+    os << "  triangle tests: " << sum.triangleTests << " ("
+       << ratio(sum.triangleTests, rays) << " per ray)\n";
+    os << "  path length: mean " << ratio(vertices, paths) << " over "
+       << paths << " paths\n";
+    for (int i = 0; i <= StatCounters::MAX_PATH_LENGTH; ++i) {
+        if (sum.pathLength[i] == 0)
+            continue;
+        os << "    " << i << (i == StatCounters::MAX_PATH_LENGTH ? "+" : "")
+           << ": " << sum.pathLength[i] << " ("
+           << 100 * ratio(sum.pathLength[i], paths) << "%)\n";
+    }
+    os << "  time:";
+    for (int i = 0; i < NUM_STAGES; ++i)
+        os << " " << stageNames[i] << " " << stageSeconds[i] << "s";
+    os << "\n";
+    os << "  BVH memory: peak " << MemoryArena::PeakBytes() / (1024.0 * 1024.0)
+       << " MB\n";
+}
+
+bool Stats::writeJson(const std::string &path)
+{
+    std::ofstream out(path);
+    if (!out)
+        return false;
+
+    StatCounters sum = total();
+    uint64_t rays = 0;
+    for (int i = 0; i < StatCounters::NUM_RAY_TYPES; ++i)
+        rays += sum.rays[i];
+
+    out << "{\n  \"rays\": {";
+    for (int i = 0; i < StatCounters::NUM_RAY_TYPES; ++i)
+        out << (i ? ", " : "") << "\"" << rayTypeNames[i] << "\": " << sum.rays[i];
+    out << "},\n";
+    out << "  \"rays_per_second\": " << perSecond(rays, stageSeconds[RENDER]) << ",\n";
+    out << "  \"node_visits\": " << sum.nodeVisits << ",\n";
+    out << "  \"triangle_tests\": " << sum.triangleTests << ",\n";
+    out << "  \"path_length_histogram\": [";
+    for (int i = 0; i <= StatCounters::MAX_PATH_LENGTH; ++i)
+        out << (i ? ", " : "") << sum.pathLength[i];
+    out << "],\n  \"seconds\": {";
+    for (int i = 0; i < NUM_STAGES; ++i)
+        out << (i ? ", " : "") << "\"" << stageNames[i] << "\": " << stageSeconds[i];
+    out << "},\n";
+    out << "  \"bvh_peak_bytes\": " << MemoryArena::PeakBytes() << "\n}\n";
+    return bool(out);
+}
@@ -0,0 +1,81 @@
+#ifndef RAYTRACING_STATS_H
+#define RAYTRACING_STATS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Render statistics. Every thread counts into its own StatCounters, so the
+// hot paths do plain increments without atomics or shared cache lines; the
+// counters of all threads are summed when the statistics are reported,
+// after rendering. Build with RAYTRACING_STATS off (the CMake option) to
+// compile the counting out; stage timings are kept either way. The
+// alignment (which also rounds the size up) keeps each thread's block on
+// cache lines of its own.
+struct alignas(64) StatCounters {
+    enum RayType { CAMERA, SHADOW, BOUNCE, NUM_RAY_TYPES };
+    // paths of this many or more vertices share the last histogram bin
+    static const int MAX_PATH_LENGTH = 32;
+
+    uint64_t rays[NUM_RAY_TYPES] = {};
+    uint64_t nodeVisits = 0;
+    uint64_t triangleTests = 0;
+    // number of paths by the number of surface hits along them
+    uint64_t pathLength[MAX_PATH_LENGTH + 1] = {};
+
+    void add(const StatCounters &other);
+};
+
+class Stats {
+public:
+    enum Stage { LOAD, BUILD, RENDER, OUTPUT, NUM_STAGES };
+
+    // the calling thread's counters
+    static StatCounters& local()
+    {
+        thread_local StatCounters *counters = registerThread();
+        return *counters;
+    }
+
+    // sum over all threads that have counted anything
+    static StatCounters total();
+
+    static void addTime(Stage stage, double seconds);
+
+    static void print(std::ostream &os);
+    static bool writeJson(const std::string &path);
+
+    // adds the lifetime of the timer to a stage
+    class Timer {
+    public:
+        explicit Timer(Stage stage)
+            : stage(stage), start(std::chrono::steady_clock::now()) {}
+        ~Timer()
+        {
+            std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            addTime(stage, elapsed.count());
+        }
+    private:
+        Stage stage;
+        std::chrono::steady_clock::time_point start;
+    };
+
+private:
+    static StatCounters* registerThread();
+};
+
+#ifdef RAYTRACING_STATS
+#define STAT_ADD(field, n) (Stats::local().field += (n))
+#define STAT_RAY(type, n) (Stats::local().rays[StatCounters::type] += (n))
+#define STAT_PATH_LENGTH(length) (++Stats::local().pathLength[ \
+    std::min<int>((length), StatCounters::MAX_PATH_LENGTH)])
+#else
+#define STAT_ADD(field, n) ((void)0)
+#define STAT_RAY(type, n) ((void)0)
+#define STAT_PATH_LENGTH(length) ((void)0)
+#endif
+
+#endif //RAYTRACING_STATS_H
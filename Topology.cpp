@@ -0,0 +1,127 @@
+#include "Topology.hpp"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// a list as in /sys/devices/system/cpu/online, e.g. "0-3,8-11"
+std::vector<int> readList(const std::string &path)
+{
+    std::vector<int> values;
+    std::ifstream file(path);
+    std::string text;
+    if (!std::getline(file, text))
+        return values;
+    std::istringstream in(text);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        int first, last;
+        char dash;
+        std::istringstream r(range);
+        if (!(r >> first))
+            continue;
+        last = (r >> dash >> last) ? last : first;
+        for (int i = first; i <= last; ++i)
+            values.push_back(i);
+    }
+    return values;
+}
+
+int readInt(const std::string &path, int fallback)
+{
+    std::ifstream file(path);
+    int value;
+    return file >> value ? value : fallback;
+}
+
+CpuTopology detect()
+{
+    CpuTopology topology;
+    const std::string sys = "/sys/devices/system/";
+    std::vector<int> online = readList(sys + "cpu/online");
+    if (online.empty()) {
+        int n = std::max(1u, std::thread::hardware_concurrency());
+        for (int i = 0; i < n; ++i)
+            topology.cpus.push_back({i, i, 0});
+        topology.physicalCores = n;
+        return topology;
+    }
+
+    std::map<int, int> nodeOf;
+    for (int node : readList(sys + "node/online"))
+        for (int cpu : readList(sys + "node/node" + std::to_string(node) + "/cpulist"))
+            nodeOf[cpu] = node;
+
+    // core ids repeat on every socket, so a core is a (package, core) pair
+    std::map<std::pair<int, int>, int> cores;
+    std::map<int, int> nodes;
+    for (int id : online) {
+        std::string dir = sys + "cpu/cpu" + std::to_string(id) + "/topology/";
+        std::pair<int, int> key(readInt(dir + "physical_package_id", 0),
+                                readInt(dir + "core_id", id));
+        int core = cores.emplace(key, (int)cores.size()).first->second;
+        int node = nodeOf.count(id) ? nodeOf[id] : 0;
+        // node ids need not be contiguous
+        node = nodes.emplace(node, (int)nodes.size()).first->second;
+        topology.cpus.push_back({id, core, node});
+    }
+    topology.physicalCores = std::max<int>(1, cores.size());
+    topology.nodes = std::max<int>(1, nodes.size());
+    return topology;
+}
+
+} // namespace
+
+const CpuTopology& CpuTopology::get()
+{
+    static const CpuTopology topology = detect();
+    return topology;
+}
+
+std::vector<int> CpuTopology::placement() const
+{
+    // per node, the first hardware thread of each core, then the others
+    std::vector<std::vector<int>> first(nodes), other(nodes);
+    std::vector<bool> used(physicalCores, false);
+    for (const Cpu &cpu : cpus) {
+        (used[cpu.core] ? other : first)[cpu.node].push_back(cpu.id);
+        used[cpu.core] = true;
+    }
+
+    std::vector<int> order;
+    for (auto *lists : {&first, &other}) {
+        for (size_t k = 0; ; ++k) {
+            bool any = false;
+            for (const std::vector<int> &list : *lists) {
+                if (k < list.size()) {
+                    order.push_back(list[k]);
+                    any = true;
+                }
+            }
+            if (!any)
+                break;
+        }
+    }
+    return order;
+}
+
+bool pinThread(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
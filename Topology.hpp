@@ -0,0 +1,34 @@
+#ifndef RAYTRACING_TOPOLOGY_H
+#define RAYTRACING_TOPOLOGY_H
+
+#include <vector>
+
+// The logical CPUs of the machine with their physical core and NUMA node,
+// as Linux reports them under /sys/devices/system. Where that cannot be
+// read, every hardware thread counts as a core of node 0.
+struct CpuTopology {
+    struct Cpu {
+        int id;
+        // unique over all sockets
+        int core;
+        int node;
+    };
+    std::vector<Cpu> cpus;
+    int physicalCores = 1;
+    int nodes = 1;
+
+    // read on the first call
+    static const CpuTopology& get();
+
+    // The logical CPUs in the order workers should be placed on them: the
+    // first hardware thread of every core before any second one, taking
+    // turns between the NUMA nodes so that fewer workers than cores are
+    // spread over all of them.
+    std::vector<int> placement() const;
+};
+
+// Restricts the calling thread to one logical CPU, false if that is not
+// possible on this system.
+bool pinThread(int cpu);
+
+#endif //RAYTRACING_TOPOLOGY_H
@@ -5,11 +5,11 @@
 #include "Material.hpp"
 #include "OBJ_Loader.hpp"
 #include "Object.hpp"
-#include "Triangle.hpp"
+#include "Stats.hpp"
 #include <cassert>
 #include <array>
 
-bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1,
+inline bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1,
                           const Vector3f& v2, const Vector3f& orig,
                           const Vector3f& dir, float& tnear, float& u, float& v)
 {
@@ -39,6 +39,116 @@ bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1,
     return true;
 }
 
+// Watertight ray/triangle test (Woop, Benthin and Wald 2013). The vertices
+// are moved into the ray's sheared frame, in which the ray runs along +z,
+// and the test reduces to the signs of three 2D edge functions. A shared
+// edge gives the same edge function on both of its triangles, so rays
+// cannot slip through the crack between them. Backfaces are culled and t
+// must lie in (t_min, t_max); u and v are the weights of v1 and v2.
+inline bool watertightIntersect(const Vector3f& v0, const Vector3f& v1,
+                                const Vector3f& v2, const Vector3f& orig,
+                                int kx, int ky, int kz,
+                                float Sx, float Sy, float Sz,
+                                float t_min, float t_max,
+                                float& t, float& u, float& v)
+{
+    Vector3f A = v0 - orig;
+    Vector3f B = v1 - orig;
+    Vector3f C = v2 - orig;
+    float Ax = A[kx] - Sx * A[kz], Ay = A[ky] - Sy * A[kz];
+    float Bx = B[kx] - Sx * B[kz], By = B[ky] - Sy * B[kz];
+    float Cx = C[kx] - Sx * C[kz], Cy = C[ky] - Sy * C[kz];
+
+    float U = Cx * By - Cy * Bx;
+    float V = Ax * Cy - Ay * Cx;
+    float W = Bx * Ay - By * Ax;
+    // a ray exactly on an edge: redo that edge in double so the sign agrees
+    // between the two triangles sharing it
+    if (U == 0.0f || V == 0.0f || W == 0.0f) {
+        U = float((double)Cx * By - (double)Cy * Bx);
+        V = float((double)Ax * Cy - (double)Ay * Cx);
+        W = float((double)Bx * Ay - (double)By * Ax);
+    }
+    if (U < 0.0f || V < 0.0f || W < 0.0f)
+        return false;
+    float det = U + V + W;
+    if (det == 0.0f)
+        return false;
+
+    // distance scaled by det, checked against the range before dividing
+    float T = Sz * (U * A[kz] + V * B[kz] + W * C[kz]);
+    if (T <= t_min * det || T >= t_max * det)
+        return false;
+
+    float det_inv = 1.0f / det;
+    t = T * det_inv;
+    u = V * det_inv;
+    v = W * det_inv;
+    return true;
+}
+
+// Ray/triangle test on a precomputed per-triangle transform (Baldwin and
+// Weber 2016, "Fast Ray-Triangle Intersections by Coordinate
+// Transformation"). The 3x4 matrix m maps the triangle onto the unit
+// triangle: rows 0 and 1 give the weights u, v of v1 and v2 at a point and
+// row 2 its signed distance from the plane. A test is then a handful of
+// dot products with no per-ray setup. The divisions by the dominant normal
+// component in the matrix make it not watertight.
+inline void precomputeTransform(const Vector3f& v0, const Vector3f& v1,
+                                const Vector3f& v2, float m[12])
+{
+    Vector3f e1 = v1 - v0, e2 = v2 - v0;
+    Vector3f n = crossProduct(e1, e2);
+    Vector3f c1 = crossProduct(v1, v0), c2 = crossProduct(v2, v0);
+    float d = -dotProduct(n, v0);
+    Vector3f a(std::fabs(n.x), std::fabs(n.y), std::fabs(n.z));
+    // a degenerate triangle gets a zero plane row, which no ray passes
+    std::fill(m, m + 12, 0.0f);
+    if (a.x > a.y && a.x > a.z) {
+        float r = 1.0f / n.x, s = 1.0f / a.x;
+        m[0] = 0.0f;       m[1] = e2.z * r;  m[2] = -e2.y * r; m[3] = c2.x * r;
+        m[4] = 0.0f;       m[5] = -e1.z * r; m[6] = e1.y * r;  m[7] = -c1.x * r;
+        m[8] = n.x * s;    m[9] = n.y * s;   m[10] = n.z * s;  m[11] = d * s;
+    } else if (a.y > a.z) {
+        float r = 1.0f / n.y, s = 1.0f / a.y;
+        m[0] = -e2.z * r;  m[1] = 0.0f;      m[2] = e2.x * r;  m[3] = c2.y * r;
+        m[4] = e1.z * r;   m[5] = 0.0f;      m[6] = -e1.x * r; m[7] = -c1.y * r;
+        m[8] = n.x * s;    m[9] = n.y * s;   m[10] = n.z * s;  m[11] = d * s;
+    } else if (a.z > 0.0f) {
+        float r = 1.0f / n.z, s = 1.0f / a.z;
+        m[0] = e2.y * r;   m[1] = -e2.x * r; m[2] = 0.0f;      m[3] = c2.z * r;
+        m[4] = -e1.y * r;  m[5] = e1.x * r;  m[6] = 0.0f;      m[7] = -c1.z * r;
+        m[8] = n.x * s;    m[9] = n.y * s;   m[10] = n.z * s;  m[11] = d * s;
+    }
+}
+
+// Backfaces are culled and t must lie in (t_min, t_max), as in
+// watertightIntersect.
+inline bool transformIntersect(const float m[12], float ox, float oy, float oz,
+                               float dx, float dy, float dz,
+                               float t_min, float t_max,
+                               float& t, float& u, float& v)
+{
+    // the plane row is scaled by a positive factor, so the sign of its dot
+    // product with the direction is that of the normal's
+    float td = m[8] * dx + m[9] * dy + m[10] * dz;
+    if (td >= 0.0f)
+        return false;
+    float T = -(m[8] * ox + m[9] * oy + m[10] * oz + m[11]) / td;
+    if (T <= t_min || T >= t_max)
+        return false;
+
+    float px = ox + T * dx, py = oy + T * dy, pz = oz + T * dz;
+    float b1 = m[0] * px + m[1] * py + m[2] * pz + m[3];
+    float b2 = m[4] * px + m[5] * py + m[6] * pz + m[7];
+    if (b1 < 0.0f || b2 < 0.0f || b1 + b2 > 1.0f)
+        return false;
+    t = T;
+    u = b1;
+    v = b2;
+    return true;
+}
+
 class Triangle : public Object
 {
 public:
@@ -48,20 +158,60 @@ public:
     Vector3f normal;
     float area;
     Material* m;
+    // displacement over the shutter interval, the vertices are those at
+    // its start
+    Vector3f motion = Vector3f(0.0f);
+#ifdef RAYTRACING_PRECOMPUTED
+    // see precomputeTransform
+    float transform[12];
+#endif
 
     Triangle(Vector3f _v0, Vector3f _v1, Vector3f _v2, Material* _m = nullptr)
-        : v0(_v0), v1(_v1), v2(_v2), m(_m)
+        : m(_m)
     {
+        setVertices(_v0, _v1, _v2);
+    }
+
+    void setVertices(const Vector3f& _v0, const Vector3f& _v1, const Vector3f& _v2)
+    {
+        v0 = _v0;
+        v1 = _v1;
+        v2 = _v2;
         e1 = v1 - v0;
         e2 = v2 - v0;
         normal = normalize(crossProduct(e1, e2));
         area = crossProduct(e1, e2).norm()*0.5f;
+#ifdef RAYTRACING_PRECOMPUTED
+        precomputeTransform(v0, v1, v2, transform);
+#endif
     }
 
     bool intersect(const Ray& ray) override;
     bool intersect(const Ray& ray, float& tnear,
                    uint32_t& index) const override;
-    Intersection getIntersection(Ray ray) override;
+    bool intersect(const Ray& ray, HitRecord& hit) override;
+    bool intersect(const Ray& ray, const RayShear& shear,
+                   HitRecord& hit) override;
+    bool occluded(const Ray& ray, const RayShear& shear) override
+    {
+        HitRecord hit;
+        hit.t = ray.t_max;
+        return intersect(ray, shear, hit);
+    }
+    void intersect(const RayPacket& packet, const bool* active,
+                   HitRecord* hits) override;
+    // a closest hit test limited to tmax finds any hit
+    void occluded(const RayPacket& packet, const bool* active,
+                  bool* occluded) override
+    {
+        HitRecord hits[RayPacket::SIZE];
+        for (int i = 0; i < RayPacket::SIZE; ++i)
+            hits[i].t = packet.tmax[i];
+        intersect(packet, active, hits);
+        for (int i = 0; i < RayPacket::SIZE; ++i)
+            occluded[i] |= hits[i].happened();
+    }
+    Intersection getSurfaceInteraction(const Ray& ray, const HitRecord& hit) override;
     void getSurfaceProperties(const Vector3f& P, const Vector3f& I,
                               const uint32_t& index, const Vector2f& uv,
                               Vector3f& N, Vector2f& st) const override
@@ -72,10 +222,15 @@ public:
     }
     Vector3f evalDiffuseColor(const Vector2f&) const override;
     Bounds3 getBounds() override;
+    Bounds3 getEndBounds() override;
     void Sample(Intersection &pos, float &pdf){
         float x = std::sqrt(get_random_float()), y = get_random_float();
         pos.coords = v0 * (1.0f - x) + v1 * (x * (1.0f - y)) + v2 * (x * y);
         pos.normal = this->normal;
+        pos.emit = m->getEmission();
+        pos.happened = true;
+        pos.obj = this;
+        pos.m = m;
         pdf = 1.0f / area;
     }
     float getArea(){
@@ -84,23 +239,101 @@ public:
     bool hasEmit(){
         return m->hasEmission();
     }
+    Vector3f getEmission(){
+        return m->getEmission();
+    }
+    float getNormalCone(Vector3f &axis){
+        axis = normal;
+        return 0.0f;
+    }
 };
 
 class MeshTriangle : public Object
 {
 public:
-    MeshTriangle(const std::string& filename, Material *mt = new Material(),
+    MeshTriangle(const std::string& filename, Material *mt = nullptr,
+        Vector3f translate = Vector3f(0,0,0), Vector3f scale = Vector3f(1,1,1),
+        Vector3f rotate = Vector3f(0,0,0))
+        : MeshTriangle(loadMesh(filename), filename, mt, translate, scale, rotate)
+    {
+    }
+
+    // build from an already loaded mesh, so that one OBJ file can be read
+    // once and placed several times. Without a material the mesh shares
+    // a default one.
+    MeshTriangle(const objl::Mesh& mesh, const std::string& name, Material *mt,
         Vector3f translate = Vector3f(0,0,0), Vector3f scale = Vector3f(1,1,1),
         Vector3f rotate = Vector3f(0,0,0))
     {
-        tag = filename;
+        tag = name;
+        area = 0;
+        m = mt ? mt : defaultMaterial();
+
+        std::vector<Vector3f> positions =
+            transformVertices(mesh, translate, scale, rotate);
+        triangles.reserve(positions.size() / 3);
+        for (size_t i = 0; i < positions.size(); i += 3) {
+            triangles.emplace_back(positions[i], positions[i + 1],
+                                   positions[i + 2], m);
+            bounding_box = Union(bounding_box, triangles.back().getBounds());
+        }
+
+        std::vector<Object*> ptrs;
+        for (auto& tri : triangles){
+            tri.tag = name;
+            ptrs.push_back(&tri);
+            area += tri.area;
+        }
+        bvh = std::make_unique<BVHAccel>(ptrs);
+    }
+
+    // Moves the vertices, three world space positions per triangle in the
+    // order of the faces, and updates the BVH (see BVHAccel::Update).
+    // Returns true if the BVH had to be rebuilt.
+    bool setVertices(const std::vector<Vector3f>& positions,
+                     float maxCostRatio = 2.0f)
+    {
+        assert(positions.size() == 3 * triangles.size());
+        bounding_box = Bounds3();
+        area = 0;
+        for (size_t i = 0; i < triangles.size(); ++i) {
+            Triangle& tri = triangles[i];
+            tri.setVertices(positions[3 * i], positions[3 * i + 1],
+                            positions[3 * i + 2]);
+            bounding_box = Union(bounding_box, tri.getBounds());
+            area += tri.area;
+        }
+        return bvh->Update(maxCostRatio);
+    }
+
+    // Gives every triangle the material, for a mesh that is reused by a
+    // scene with other materials. Geometry and BVH are unchanged.
+    void setMaterial(Material *mt)
+    {
+        m = mt ? mt : defaultMaterial();
+        for (Triangle& tri : triangles)
+            tri.m = m;
+    }
+
+    static Material* defaultMaterial()
+    {
+        static Material material;
+        return &material;
+    }
+
+    static objl::Mesh loadMesh(const std::string& filename)
+    {
         objl::Loader loader;
         loader.LoadFile(filename);
-        area = 0;
-        m = mt;
         assert(loader.LoadedMeshes.size() == 1);
-        auto mesh = loader.LoadedMeshes[0];
+        return loader.LoadedMeshes[0];
+    }
 
+    // world space positions of the mesh's vertices, three per face, after
+    // scaling, rotating (degrees) and translating it
+    static std::vector<Vector3f> transformVertices(const objl::Mesh& mesh,
+        const Vector3f& translate, const Vector3f& scale, const Vector3f& rotate)
+    {
         auto toWorld = [&](Vector3f &target) {
             // scale
             target = scale * target;
@@ -128,59 +361,24 @@ public:
             target = target + translate;
         };
 
-        Vector3f min_vert = Vector3f{std::numeric_limits<float>::infinity(),
-                                     std::numeric_limits<float>::infinity(),
-                                     std::numeric_limits<float>::infinity()};
-        Vector3f max_vert = Vector3f{-std::numeric_limits<float>::infinity(),
-                                     -std::numeric_limits<float>::infinity(),
-                                     -std::numeric_limits<float>::infinity()};
-        for (int i = 0; i < mesh.Vertices.size(); i += 3) {
-            std::array<Vector3f, 3> face_vertices;
-
-            for (int j = 0; j < 3; j++) {
-                auto vert = Vector3f(mesh.Vertices[i + j].Position.X,
-                                     mesh.Vertices[i + j].Position.Y,
-                                     mesh.Vertices[i + j].Position.Z);
-                toWorld(vert);
-                face_vertices[j] = vert;
-                
-
-                min_vert = Vector3f(std::min(min_vert.x, vert.x),
-                                    std::min(min_vert.y, vert.y),
-                                    std::min(min_vert.z, vert.z));
-                max_vert = Vector3f(std::max(max_vert.x, vert.x),
-                                    std::max(max_vert.y, vert.y),
-                                    std::max(max_vert.z, vert.z));
-            }
-
-            // if (filename == "../models/bunny/bunny.obj") {
-            //     std::cout << face_vertices[0] << std::endl;
-            //     std::cout << face_vertices[1] << std::endl;
-            //     std::cout << face_vertices[2] << std::endl;
-            // }   
-
-            triangles.emplace_back(face_vertices[0], face_vertices[1],
-                                   face_vertices[2], mt);
+        std::vector<Vector3f> positions;
+        positions.reserve(mesh.Vertices.size());
+        for (const auto& vertex : mesh.Vertices) {
+            auto vert = Vector3f(vertex.Position.X, vertex.Position.Y,
+                                 vertex.Position.Z);
+            toWorld(vert);
+            positions.push_back(vert);
         }
-        
-        bounding_box = Bounds3(min_vert, max_vert);
-
-        std::vector<Object*> ptrs;
-        for (auto& tri : triangles){
-            tri.tag = filename;
-            ptrs.push_back(&tri);
-            area += tri.area;
-        }
-        bvh = new BVHAccel(ptrs);
+        return positions;
     }
 
     
     // MeshTriangle(const std::string& filename, Vector3f translate, 
-    //     Vector3f rotate, Vector3f scale,  Material *mt = new Material()) {
+    //     Vector3f rotate, Vector3f scale,  Material *mt = nullptr) {
 
     // }
 
-    bool intersect(const Ray& ray) { return true; }
+    bool intersect(const Ray& ray) { return bvh && bvh->IntersectP(ray); }
 
     bool intersect(const Ray& ray, float& tnear, uint32_t& index) const
     {
@@ -203,6 +401,20 @@ public:
     }
 
     Bounds3 getBounds() { return bounding_box; }
+    Bounds3 getEndBounds()
+    {
+        return Bounds3(bounding_box.pMin + motion, bounding_box.pMax + motion);
+    }
+
+    // Moves the whole mesh by displacement over the shutter interval. The
+    // BVH is refitted, its nodes keep the bounds at both ends.
+    void setMotion(const Vector3f& displacement)
+    {
+        motion = displacement;
+        for (auto& tri : triangles)
+            tri.motion = displacement;
+        bvh->Refit();
+    }
 
     void getSurfaceProperties(const Vector3f& P, const Vector3f& I,
                               const uint32_t& index, const Vector2f& uv,
@@ -229,15 +441,41 @@ public:
                     Vector3f(0.937, 0.937, 0.231), pattern);
     }
 
-    Intersection getIntersection(Ray ray)
+    // hits record the triangle, which computes the surface interaction
+    bool intersect(const Ray& ray, HitRecord &hit)
+    {
+        return bvh && bvh->Intersect(ray, hit);
+    }
+
+    bool intersect(const Ray& ray, const RayShear &shear, HitRecord &hit)
     {
-        Intersection intersec;
+        return bvh && bvh->Intersect(ray, shear, hit);
+    }
+
+    bool occluded(const Ray& ray, const RayShear &shear)
+    {
+        return bvh && bvh->IntersectP(ray, shear);
+    }
 
+    void intersect(const RayPacket &packet, const bool *active,
+                   HitRecord *hits)
+    {
         if (bvh) {
-            intersec = bvh->Intersect(ray);
+            bvh->IntersectPacket(packet, active, hits);
         }
+    }
 
-        return intersec;
+    void occluded(const RayPacket &packet, const bool *active,
+                  bool *occluded)
+    {
+        if (bvh) {
+            bvh->OccludedPacket(packet, active, occluded);
+        }
+    }
+
+    Intersection getSurfaceInteraction(const Ray &ray, const HitRecord &hit)
+    {
+        return hit.prim->getSurfaceInteraction(ray, hit);
     }
     
     void Sample(Intersection &pos, float &pdf){
@@ -250,6 +488,16 @@ public:
     bool hasEmit(){
         return m->hasEmission();
     }
+    Vector3f getEmission(){
+        return m->getEmission();
+    }
+    // emissive meshes are sampled per triangle, so that the light pdf of a
+    // hit can be looked up from the triangle stored in the Intersection
+    void getEmitters(std::vector<Object*> &emitters){
+        if (!hasEmit()) return;
+        for (auto& tri : triangles)
+            emitters.push_back(&tri);
+    }
 
     Bounds3 bounding_box;
     std::unique_ptr<Vector3f[]> vertices;
@@ -259,13 +507,19 @@ public:
 
     std::vector<Triangle> triangles;
 
-    BVHAccel* bvh;
+    std::unique_ptr<BVHAccel> bvh;
     float area;
+    Vector3f motion = Vector3f(0.0f);
 
     Material* m;
 };
 
-inline bool Triangle::intersect(const Ray& ray) { return true; }
+inline bool Triangle::intersect(const Ray& ray)
+{
+    HitRecord hit;
+    hit.t = ray.t_max;
+    return intersect(ray, hit);
+}
 inline bool Triangle::intersect(const Ray& ray, float& tnear,
                                 uint32_t& index) const
 {
@@ -273,36 +527,194 @@ inline bool Triangle::intersect(const Ray& ray, float& tnear,
 }
 
 inline Bounds3 Triangle::getBounds() { return Union(Bounds3(v0, v1), v2); }
+inline Bounds3 Triangle::getEndBounds()
+{
+    return Union(Bounds3(v0 + motion, v1 + motion), v2 + motion);
+}
 
-inline Intersection Triangle::getIntersection(Ray ray)
+// The kernels below move the ray origin back by the displacement at the
+// ray's time instead of moving the triangle.
+
+#if defined(RAYTRACING_PRECOMPUTED)
+
+inline bool Triangle::intersect(const Ray& ray, HitRecord& hit)
 {
-    Intersection inter;
+    STAT_ADD(triangleTests, 1);
+    Vector3f o = ray.origin - motion * ray.t;
+    float t, u, v;
+    if (!transformIntersect(transform, o.x, o.y, o.z, ray.direction.x,
+                            ray.direction.y, ray.direction.z, ray.t_min,
+                            hit.t, t, u, v))
+        return false;
+
+    hit.t = t;
+    hit.u = u;
+    hit.v = v;
+    hit.prim = this;
+    return true;
+}
+
+// the transform needs no shear
+inline bool Triangle::intersect(const Ray& ray, const RayShear&, HitRecord& hit)
+{
+    return intersect(ray, hit);
+}
+
+inline void Triangle::intersect(const RayPacket& p, const bool* active,
+                                HitRecord* hits)
+{
+#ifdef RAYTRACING_STATS
+    for (int i = 0; i < RayPacket::SIZE; ++i)
+        STAT_ADD(triangleTests, active[i]);
+#endif
+    Vector3f shift = motion * p.time;
+    for (int i = 0; i < RayPacket::SIZE; ++i) {
+        float t, u, v;
+        if (active[i] &&
+            transformIntersect(transform, p.ox[i] - shift.x, p.oy[i] - shift.y,
+                               p.oz[i] - shift.z, p.dx[i], p.dy[i], p.dz[i],
+                               p.tmin[i], hits[i].t, t, u, v)) {
+            hits[i].t = t;
+            hits[i].u = u;
+            hits[i].v = v;
+            hits[i].prim = this;
+        }
+    }
+}
+
+#elif defined(RAYTRACING_WATERTIGHT)
+
+inline bool Triangle::intersect(const Ray& ray, HitRecord& hit)
+{
+    return intersect(ray, RayShear(ray.direction), hit);
+}
 
-    if (dotProduct(ray.direction, normal) > 0)
-        return inter;
-    double u, v, t_tmp = 0;
+inline bool Triangle::intersect(const Ray& ray, const RayShear& shear,
+                                HitRecord& hit)
+{
+    STAT_ADD(triangleTests, 1);
+    float t, u, v;
+    if (!watertightIntersect(v0, v1, v2, ray.origin - motion * ray.t,
+                             shear.kx, shear.ky, shear.kz,
+                             shear.Sx, shear.Sy, shear.Sz, ray.t_min, hit.t, t, u, v))
+        return false;
+
+    hit.t = t;
+    hit.u = u;
+    hit.v = v;
+    hit.prim = this;
+    return true;
+}
+
+inline void Triangle::intersect(const RayPacket& p, const bool* active,
+                                HitRecord* hits)
+{
+#ifdef RAYTRACING_STATS
+    for (int i = 0; i < RayPacket::SIZE; ++i)
+        STAT_ADD(triangleTests, active[i]);
+#endif
+    Vector3f shift = motion * p.time;
+    for (int i = 0; i < RayPacket::SIZE; ++i) {
+        float t, u, v;
+        if (active[i] &&
+            watertightIntersect(v0, v1, v2, Vector3f(p.ox[i], p.oy[i], p.oz[i]) - shift,
+                                p.kx[i], p.ky[i], p.kz[i], p.sx[i], p.sy[i],
+                                p.sz[i], p.tmin[i], hits[i].t, t, u, v)) {
+            hits[i].t = t;
+            hits[i].u = u;
+            hits[i].v = v;
+            hits[i].prim = this;
+        }
+    }
+}
+
+#else
+
+// Moeller-Trumbore on the precomputed edges e1, e2. The sign of the
+// determinant culls backfaces; near-zero determinants (rays grazing the
+// plane, and very thin triangles) are dropped, which can leave cracks.
+inline bool Triangle::intersect(const Ray& ray, HitRecord& hit)
+{
+    STAT_ADD(triangleTests, 1);
     Vector3f pvec = crossProduct(ray.direction, e2);
-    double det = dotProduct(e1, pvec);
-    if (fabs(det) < EPSILON)
-        return inter;
+    float det = dotProduct(e1, pvec);
+    if (det < EPSILON)
+        return false;
 
-    double det_inv = 1. / det;
-    Vector3f tvec = ray.origin - v0;
-    u = dotProduct(tvec, pvec) * det_inv;
+    float det_inv = 1.0f / det;
+    Vector3f tvec = ray.origin - motion * ray.t - v0;
+    float u = dotProduct(tvec, pvec) * det_inv;
     if (u < 0 || u > 1)
-        return inter;
+        return false;
     Vector3f qvec = crossProduct(tvec, e1);
-    v = dotProduct(ray.direction, qvec) * det_inv;
+    float v = dotProduct(ray.direction, qvec) * det_inv;
     if (v < 0 || u + v > 1)
-        return inter;
-    t_tmp = dotProduct(e2, qvec) * det_inv;
+        return false;
+    float t = dotProduct(e2, qvec) * det_inv;
+    if (t <= ray.t_min || t >= hit.t)
+        return false;
+
+    hit.t = t;
+    hit.u = u;
+    hit.v = v;
+    hit.prim = this;
+    return true;
+}
+
+// Moeller-Trumbore needs no shear
+inline bool Triangle::intersect(const Ray& ray, const RayShear&, HitRecord& hit)
+{
+    return intersect(ray, hit);
+}
 
-    // TODO find ray triangle intersection
+// the same test as above, run over all lanes of a packet
+inline void Triangle::intersect(const RayPacket& p, const bool* active,
+                                HitRecord* hits)
+{
+#ifdef RAYTRACING_STATS
+    for (int i = 0; i < RayPacket::SIZE; ++i)
+        STAT_ADD(triangleTests, active[i]);
+#endif
+    Vector3f o = v0 + motion * p.time;
+    for (int i = 0; i < RayPacket::SIZE; ++i) {
+        // pvec = dir x e2
+        float px = p.dy[i] * e2.z - p.dz[i] * e2.y;
+        float py = p.dz[i] * e2.x - p.dx[i] * e2.z;
+        float pz = p.dx[i] * e2.y - p.dy[i] * e2.x;
+        float det = e1.x * px + e1.y * py + e1.z * pz;
+        float det_inv = 1.0f / det;
+        float tx = p.ox[i] - o.x, ty = p.oy[i] - o.y, tz = p.oz[i] - o.z;
+        float u = (tx * px + ty * py + tz * pz) * det_inv;
+        // qvec = tvec x e1
+        float qx = ty * e1.z - tz * e1.y;
+        float qy = tz * e1.x - tx * e1.z;
+        float qz = tx * e1.y - ty * e1.x;
+        float v = (p.dx[i] * qx + p.dy[i] * qy + p.dz[i] * qz) * det_inv;
+        float t = (e2.x * qx + e2.y * qy + e2.z * qz) * det_inv;
+        bool hit = active[i] & (det >= EPSILON) &
+                   (u >= 0) & (u <= 1) & (v >= 0) & (u + v <= 1) &
+                   (t > p.tmin[i]) & (t < hits[i].t);
+        if (hit) {
+            hits[i].t = t;
+            hits[i].u = u;
+            hits[i].v = v;
+            hits[i].prim = this;
+        }
+    }
+}
+
+#endif
+
+inline Intersection Triangle::getSurfaceInteraction(const Ray& ray,
+                                                    const HitRecord& hit)
+{
+    Intersection inter;
     inter.happened = true;
-    inter.coords = ray.origin + t_tmp*ray.direction;
+    inter.coords = v0 * (1 - hit.u - hit.v) + v1 * hit.u + v2 * hit.v +
+                   motion * ray.t;
     inter.emit = this->m->getEmission();
     inter.normal = normal;
-    inter.distance = t_tmp;
+    inter.distance = hit.t;
     inter.obj = this;
     inter.m = this->m;
     return inter;
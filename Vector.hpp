@@ -9,6 +9,63 @@
 #include <cmath>
 #include <algorithm>
 
+// With RAYTRACING_USE_SSE defined (the RAYTRACING_SIMD CMake option) and an
+// SSE2 target, Vector3f is padded to one 16-byte SSE register and its
+// arithmetic, dot/cross products, min/max and normalization are vectorized.
+// Otherwise it is three scalar floats.
+#if defined(RAYTRACING_USE_SSE) && defined(__SSE2__)
+#define RAYTRACING_VECTOR_SSE 1
+#include <immintrin.h>
+#endif
+
+#ifdef RAYTRACING_VECTOR_SSE
+
+class alignas(16) Vector3f {
+public:
+    // the fourth lane is padding and kept at zero
+    union {
+        __m128 m;
+        struct { float x, y, z, w; };
+    };
+    Vector3f() : m(_mm_setzero_ps()) {}
+    Vector3f(float xx) : m(_mm_set_ps(0, xx, xx, xx)) {}
+    Vector3f(float xx, float yy, float zz) : m(_mm_set_ps(0, zz, yy, xx)) {}
+    explicit Vector3f(__m128 v) : m(v) {}
+    Vector3f operator * (const float &r) const { return Vector3f(_mm_mul_ps(m, _mm_set1_ps(r))); }
+    Vector3f operator / (const float &r) const { return Vector3f(_mm_div_ps(m, _mm_set1_ps(r))); }
+
+    float norm() const { return std::sqrt(x * x + y * y + z * z); }
+    Vector3f normalized() const {
+        float n = norm();
+        return *this / n;
+    }
+
+    Vector3f operator * (const Vector3f &v) const { return Vector3f(_mm_mul_ps(m, v.m)); }
+    Vector3f operator - (const Vector3f &v) const { return Vector3f(_mm_sub_ps(m, v.m)); }
+    Vector3f operator + (const Vector3f &v) const { return Vector3f(_mm_add_ps(m, v.m)); }
+    Vector3f operator - () const { return Vector3f(_mm_sub_ps(_mm_setzero_ps(), m)); }
+    Vector3f& operator += (const Vector3f &v) { m = _mm_add_ps(m, v.m); return *this; }
+    friend Vector3f operator * (const float &r, const Vector3f &v)
+    { return Vector3f(_mm_mul_ps(v.m, _mm_set1_ps(r))); }
+    friend std::ostream & operator << (std::ostream &os, const Vector3f &v)
+    { return os << v.x << ", " << v.y << ", " << v.z; }
+    float        operator[](int index) const { return (&x)[index]; }
+    float&       operator[](int index) { return (&x)[index]; }
+
+    float minComponent() const { return std::min(x, std::min(y, z)); }
+    float maxComponent() const { return std::max(x, std::max(y, z)); }
+
+    static Vector3f Min(const Vector3f &p1, const Vector3f &p2) {
+        return Vector3f(_mm_min_ps(p1.m, p2.m));
+    }
+
+    static Vector3f Max(const Vector3f &p1, const Vector3f &p2) {
+        return Vector3f(_mm_max_ps(p1.m, p2.m));
+    }
+};
+
+#else
+
 class Vector3f {
 public:
     float x, y, z;
@@ -18,8 +75,8 @@ public:
     Vector3f operator * (const float &r) const { return Vector3f(x * r, y * r, z * r); }
     Vector3f operator / (const float &r) const { return Vector3f(x / r, y / r, z / r); }
 
-    float norm() {return std::sqrt(x * x + y * y + z * z);}
-    Vector3f normalized() {
+    float norm() const {return std::sqrt(x * x + y * y + z * z);}
+    Vector3f normalized() const {
         float n = std::sqrt(x * x + y * y + z * z);
         return Vector3f(x / n, y / n, z / n);
     }
@@ -33,9 +90,11 @@ public:
     { return Vector3f(v.x * r, v.y * r, v.z * r); }
     friend std::ostream & operator << (std::ostream &os, const Vector3f &v)
     { return os << v.x << ", " << v.y << ", " << v.z; }
-    double       operator[](int index) const;
-    double&      operator[](int index);
+    float        operator[](int index) const { return (&x)[index]; }
+    float&       operator[](int index) { return (&x)[index]; }
 
+    float minComponent() const { return std::min(x, std::min(y, z)); }
+    float maxComponent() const { return std::max(x, std::max(y, z)); }
 
     static Vector3f Min(const Vector3f &p1, const Vector3f &p2) {
         return Vector3f(std::min(p1.x, p2.x), std::min(p1.y, p2.y),
@@ -47,9 +106,8 @@ public:
                        std::max(p1.z, p2.z));
     }
 };
-inline double Vector3f::operator[](int index) const {
-    return (&x)[index];
-}
+
+#endif
 
 
 class Vector2f
@@ -66,6 +124,46 @@ public:
 inline Vector3f lerp(const Vector3f &a, const Vector3f& b, const float &t)
 { return a * (1 - t) + b * t; }
 
+#ifdef RAYTRACING_VECTOR_SSE
+
+// sum of the x, y and z lanes, broadcast to every lane
+inline __m128 hsum3(__m128 v)
+{
+    __m128 y = _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 z = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2));
+    __m128 s = _mm_add_ss(_mm_add_ss(v, y), z);
+    return _mm_shuffle_ps(s, s, _MM_SHUFFLE(0, 0, 0, 0));
+}
+
+inline Vector3f normalize(const Vector3f &v)
+{
+    __m128 mag2 = hsum3(_mm_mul_ps(v.m, v.m));
+    if (_mm_cvtss_f32(mag2) > 0) {
+        // rsqrt estimate refined with one Newton-Raphson step
+        __m128 r = _mm_rsqrt_ps(mag2);
+        __m128 half_mag2 = _mm_mul_ps(mag2, _mm_set1_ps(0.5f));
+        r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f),
+            _mm_mul_ps(half_mag2, _mm_mul_ps(r, r))));
+        return Vector3f(_mm_mul_ps(v.m, r));
+    }
+
+    return v;
+}
+
+inline float dotProduct(const Vector3f &a, const Vector3f &b)
+{ return _mm_cvtss_f32(hsum3(_mm_mul_ps(a.m, b.m))); }
+
+inline Vector3f crossProduct(const Vector3f &a, const Vector3f &b)
+{
+    // (a * b.yzx - a.yzx * b).yzx, the padding lane stays zero
+    __m128 a_yzx = _mm_shuffle_ps(a.m, a.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_yzx = _mm_shuffle_ps(b.m, b.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a.m, b_yzx), _mm_mul_ps(a_yzx, b.m));
+    return Vector3f(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+}
+
+#else
+
 inline Vector3f normalize(const Vector3f &v)
 {
     float mag2 = v.x * v.x + v.y * v.y + v.z * v.z;
@@ -89,6 +187,8 @@ inline Vector3f crossProduct(const Vector3f &a, const Vector3f &b)
     );
 }
 
+#endif
+
 
 
 #endif //RAYTRACING_VECTOR_H
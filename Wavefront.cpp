@@ -0,0 +1,190 @@
+#include "Wavefront.hpp"
+
+void PathQueue::push(const Vector3f &o, const Vector3f &d, uint32_t p, float t)
+{
+    origin.push_back(o);
+    direction.push_back(d);
+    throughput.push_back(Vector3f(1.0f));
+    pixel.push_back(p);
+    depth.push_back(0);
+    time.push_back(t);
+    hitCoords.emplace_back();
+    hitNormal.emplace_back();
+    hitMaterial.push_back(nullptr);
+    alive.push_back(true);
+}
+
+void PathQueue::compact()
+{
+    size_t n = 0;
+    for (size_t i = 0; i < size(); ++i) {
+        if (!alive[i])
+            continue;
+        if (n != i) {
+            origin[n] = origin[i];
+            direction[n] = direction[i];
+            throughput[n] = throughput[i];
+            pixel[n] = pixel[i];
+            depth[n] = depth[i];
+            time[n] = time[i];
+            hitCoords[n] = hitCoords[i];
+            hitNormal[n] = hitNormal[i];
+            hitMaterial[n] = hitMaterial[i];
+            alive[n] = true;
+        }
+        ++n;
+    }
+    origin.resize(n); direction.resize(n); throughput.resize(n);
+    pixel.resize(n); depth.resize(n); time.resize(n);
+    hitCoords.resize(n); hitNormal.resize(n); hitMaterial.resize(n);
+    alive.resize(n);
+}
+
+void ShadowQueue::clear()
+{
+    origin.clear(); direction.clear(); contribution.clear();
+    tMax.clear(); time.clear(); pixel.clear();
+}
+
+void ShadowQueue::push(const Ray &ray, const Vector3f &L, uint32_t p)
+{
+    origin.push_back(ray.origin);
+    direction.push_back(ray.direction);
+    tMax.push_back(ray.t_max);
+    time.push_back(ray.t);
+    contribution.push_back(L);
+    pixel.push_back(p);
+}
+
+static inline int octant(const Vector3f &d)
+{
+    return (d.x < 0) | ((d.y < 0) << 1) | ((d.z < 0) << 2);
+}
+
+template<typename Key>
+void WavefrontIntegrator::binBy(size_t n, int numBins, Key key)
+{
+    binStart.assign(numBins + 1, 0);
+    for (size_t i = 0; i < n; ++i)
+        ++binStart[key(i) + 1];
+    for (int b = 0; b < numBins; ++b)
+        binStart[b + 1] += binStart[b];
+    order.resize(n);
+    std::vector<uint32_t> cursor(binStart.begin(), binStart.end() - 1);
+    for (size_t i = 0; i < n; ++i)
+        order[cursor[key(i)]++] = i;
+}
+
+void WavefrontIntegrator::render(const PrimaryRay &primaryRay, size_t numPixels,
+                                 int spp, std::vector<Vector3f> &result)
+{
+    std::vector<Vector3f> accum(numPixels, Vector3f(0.0f));
+    size_t total = numPixels * (size_t)spp, next = 0;
+
+    while (next < total || paths.size() > 0) {
+        generate(primaryRay, numPixels, next, total);
+        intersect();
+        shade(accum);
+        traceShadows(accum);
+        paths.compact();
+    }
+
+    result.resize(numPixels);
+    for (size_t i = 0; i < accum.size(); ++i)
+        result[i] = accum[i] / spp;
+}
+
+// top the batch up with new camera paths, consecutive paths going to
+// neighbouring pixels so that primary rays stay coherent
+void WavefrontIntegrator::generate(const PrimaryRay &primaryRay, size_t numPixels,
+                                   size_t &next, size_t total)
+{
+    while (paths.size() < BATCH_SIZE && next < total) {
+        uint32_t p = next % numPixels;
+        Ray ray = primaryRay(p);
+        paths.push(ray.origin, ray.direction, p, ray.t);
+        ++next;
+    }
+}
+
+void WavefrontIntegrator::intersect()
+{
+    binBy(paths.size(), 8, [&](size_t i) { return octant(paths.direction[i]); });
+    for (uint32_t i : order) {
+#ifdef RAYTRACING_STATS
+        if (paths.depth[i] == 0) STAT_RAY(CAMERA, 1);
+        else STAT_RAY(BOUNCE, 1);
+#endif
+        Intersection hit = scene.intersect(Ray(paths.origin[i], paths.direction[i],
+                                               paths.time[i]));
+        if (!hit.happened) {
+            paths.alive[i] = false;
+            STAT_PATH_LENGTH(paths.depth[i]);
+            continue;
+        }
+        paths.hitCoords[i] = hit.coords;
+        paths.hitNormal[i] = normalize(hit.normal);
+        paths.hitMaterial[i] = hit.m;
+    }
+}
+
+// same estimator as Scene::castRay, one bounce of every live path
+void WavefrontIntegrator::shade(std::vector<Vector3f> &accum)
+{
+    binBy(paths.size(), 3, [&](size_t i) {
+        return paths.alive[i] ? 1 + (int)paths.hitMaterial[i]->getType() : 0;
+    });
+    // a path ending at its current hit has depth + 1 vertices
+    auto terminate = [&](uint32_t i) {
+        paths.alive[i] = false;
+        STAT_PATH_LENGTH(paths.depth[i] + 1);
+    };
+
+    for (size_t k = binStart[1]; k < paths.size(); ++k) {
+        uint32_t i = order[k];
+        Material *m = paths.hitMaterial[i];
+        const Vector3f &p = paths.hitCoords[i];
+        const Vector3f &N = paths.hitNormal[i];
+        Vector3f wo = -paths.direction[i];
+
+        Vector3f emit = m->getEmission();
+        if (emit.norm() > EPSILON) {
+            if (paths.depth[i] == 0)
+                accum[paths.pixel[i]] += paths.throughput[i] * emit;
+            terminate(i);
+            continue;
+        }
+
+        // queue a shadow ray for direct lighting
+        Intersection current;
+        current.happened = true;
+        current.coords = p;
+        current.normal = N;
+        current.m = m;
+        Ray shadow(p, N, paths.time[i]);
+        Vector3f contribution;
+        if (scene.sampleDirect(current, wo, paths.time[i], shadow, contribution))
+            shadows.push(shadow, paths.throughput[i] * contribution, paths.pixel[i]);
+
+        Ray next(p, -wo, paths.time[i]);
+        if (!scene.continuePath(current, wo, paths.depth[i],
+                                paths.throughput[i], next)) {
+            terminate(i);
+            continue;
+        }
+        paths.origin[i] = next.origin;
+        paths.direction[i] = next.direction;
+        ++paths.depth[i];
+    }
+}
+
+void WavefrontIntegrator::traceShadows(std::vector<Vector3f> &accum)
+{
+    binBy(shadows.size(), 8, [&](size_t i) { return octant(shadows.direction[i]); });
+    for (uint32_t i : order) {
+        if (!scene.occluded(Ray(shadows.origin[i], shadows.direction[i],
+                                shadows.time[i], shadows.tMax[i])))
+            accum[shadows.pixel[i]] += shadows.contribution[i];
+    }
+    shadows.clear();
+}
@@ -0,0 +1,75 @@
+#ifndef RAYTRACING_WAVEFRONT_H
+#define RAYTRACING_WAVEFRONT_H
+
+#include <functional>
+#include <vector>
+#include <cstdint>
+#include "Scene.hpp"
+
+// Path state of the wavefront integrator, one array per field
+struct PathQueue {
+    std::vector<Vector3f> origin, direction, throughput;
+    std::vector<uint32_t> pixel;
+    std::vector<int> depth;
+    // shutter time of the path, see Ray::t
+    std::vector<float> time;
+    // filled in by the intersect stage
+    std::vector<Vector3f> hitCoords, hitNormal;
+    std::vector<Material*> hitMaterial;
+    std::vector<bool> alive;
+
+    size_t size() const { return origin.size(); }
+    void push(const Vector3f &o, const Vector3f &d, uint32_t p, float t);
+    // move every live path to the front and drop the rest
+    void compact();
+};
+
+// Shadow rays to the lights with the radiance they carry if unoccluded
+struct ShadowQueue {
+    std::vector<Vector3f> origin, direction, contribution;
+    std::vector<float> tMax, time;
+    std::vector<uint32_t> pixel;
+
+    size_t size() const { return origin.size(); }
+    void clear();
+    void push(const Ray &ray, const Vector3f &L, uint32_t p);
+};
+
+// Wavefront (stream) path tracer. Instead of following one path at a time
+// as Scene::castRay does, a batch of paths advances in stages: generate
+// camera rays, intersect, shade, trace shadow rays. Rays are binned by
+// direction octant before traversal and hits by material type before
+// shading, so each stage runs over coherent work.
+class WavefrontIntegrator {
+public:
+    static const int BATCH_SIZE = 1 << 14;
+
+    // camera ray of pixel i, called again for every sample
+    using PrimaryRay = std::function<Ray(uint32_t)>;
+
+    explicit WavefrontIntegrator(Scene &scene) : scene(scene) {}
+
+    // trace spp paths for each of numPixels pixels and store the mean
+    // radiance of each
+    void render(const PrimaryRay &primaryRay, size_t numPixels, int spp,
+                std::vector<Vector3f> &result);
+
+private:
+    void generate(const PrimaryRay &primaryRay, size_t numPixels,
+                  size_t &next, size_t total);
+    void intersect();
+    void shade(std::vector<Vector3f> &accum);
+    void traceShadows(std::vector<Vector3f> &accum);
+
+    // counting sort of [0, n) into order by a small integer key
+    template<typename Key>
+    void binBy(size_t n, int numBins, Key key);
+
+    Scene &scene;
+    PathQueue paths;
+    ShadowQueue shadows;
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> binStart;
+};
+
+#endif //RAYTRACING_WAVEFRONT_H
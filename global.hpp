@@ -1,6 +1,7 @@
 #pragma once
 #include <iostream>
 #include <cmath>
+#include <cstdint>
 #include <random>
 #include <unordered_map>
 #include <thread>
@@ -11,23 +12,26 @@
 extern const float  EPSILON;
 const float kInfinity = std::numeric_limits<float>::max();
 
-inline std::unordered_map<size_t,std::random_device *> random_devices;
-inline std::unordered_map<size_t, std::mt19937> rngs;
-
-inline void init_random_device() {
-    std::random_device *dev = new std::random_device();
-    int hash = std::hash<std::thread::id>{}(std::this_thread::get_id());
-    rngs[hash] = std::mt19937((*dev)());
-    random_devices[hash] = dev;
+// Every thread draws from its own generator. The renderer reseeds it at
+// the start of each task from the scene seed and the task's pixels, so an
+// image only depends on the seed and not on which thread ran what.
+inline std::mt19937& thread_rng()
+{
+    thread_local std::mt19937 rng(std::random_device{}());
+    return rng;
 }
 
-inline void delete_random_device() {
-    int hash = std::hash<std::thread::id>{}(std::this_thread::get_id());
-    try {
-        delete random_devices[hash];
-    } catch(...) {}
+// well mixed 32-bit seed from a base seed and a key (splitmix64)
+inline uint32_t mix_seed(uint64_t seed, uint64_t key)
+{
+    uint64_t z = seed * 0x9e3779b97f4a7c15ull + key;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return uint32_t(z ^ (z >> 31));
 }
 
+inline void seed_random(uint32_t seed) { thread_rng().seed(seed); }
+
 inline float clamp(const float &lo, const float &hi, const float &v)
 { return std::max(lo, std::min(hi, v)); }
 
@@ -49,12 +53,9 @@ inline  bool solveQuadratic(const float &a, const float &b, const float &c, floa
 
 inline float get_random_float()
 {
-    // std::random_device dev;
-    // std::mt19937 rng(dev());
-    int hash = std::hash<std::thread::id>{}(std::this_thread::get_id());
-    std::uniform_real_distribution<float> dist(0.f, 1.f); // distribution in range [1, 6]
+    std::uniform_real_distribution<float> dist(0.f, 1.f);
 
-    return dist(rngs[hash]);
+    return dist(thread_rng());
 }
 
 inline void UpdateProgress(float progress)
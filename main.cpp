@@ -1,105 +1,250 @@
+#include "Image.hpp"
+#include "Preview.hpp"
 #include "Renderer.hpp"
+#include "RenderServer.hpp"
 #include "Scene.hpp"
-#include "Triangle.hpp"
-#include "Sphere.hpp"
+#include "SceneLoader.hpp"
 #include "Vector.hpp"
 #include "global.hpp"
 #include <chrono>
+#include <cstdio>
 
-// In the main function of the program, we create the scene (create objects and
-// lights) as well as set the options for the render (image width and height,
-// maximum recursion depth, field-of-view, etc.). We then call the render
-// function().
+// path of the image of one camera and frame: the camera name (if there are
+// several) and frame number (in sequences) go before the extension
+static std::string outputPath(const std::string &path, const Scene &scene,
+                              const Camera &camera, int frame)
+{
+    if (path.empty())
+        return path;
+    std::string suffix;
+    if (scene.cameras.size() > 1)
+        suffix += "_" + camera.name;
+    if (scene.frames > 1) {
+        char number[16];
+        std::snprintf(number, sizeof(number), "_%04d", frame);
+        suffix += number;
+    }
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || path.find('/', dot) != std::string::npos)
+        return path + suffix;
+    return path.substr(0, dot) + suffix + path.substr(dot);
+}
+
+// Renders the first camera at 1, 2, 4, ... samples per pixel up to
+// scene.spp and prints the error against a reference image and the
+// efficiency (inverse of relMSE times seconds) of every level. Returns the
+// relMSE of the last level, a negative value if the reference cannot be
+// read or has the wrong size, or NaN if the image cannot be compared with
+// it (see compareImages).
+static double compareConvergence(Renderer &r, Scene &scene,
+                                 const std::string &referencePath,
+                                 double targetRelMSE)
+{
+    int w, h;
+    std::vector<Vector3f> reference;
+    if (!readPFM(referencePath, w, h, reference)) {
+        std::cerr << "Cannot read reference image " << referencePath << "\n";
+        return -1;
+    }
+    if (w != scene.width || h != scene.height) {
+        std::cerr << "Reference image is " << w << "x" << h << ", the scene renders "
+                  << scene.width << "x" << scene.height << "\n";
+        return -1;
+    }
+
+    struct Level { int spp; double seconds; ImageError error; };
+    std::vector<Level> levels;
+    for (int spp = 1; ; spp = std::min(2 * spp, scene.spp)) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Vector3f> image = r.RenderImage(scene, scene.cameras[0], spp);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        levels.push_back({spp, elapsed.count(), compareImages(image, reference)});
+        if (spp == scene.spp) break;
+    }
+
+    std::printf("\n%8s %10s %12s %12s %12s\n", "spp", "seconds", "RMSE", "relMSE", "efficiency");
+    const Level *target = nullptr;
+    for (const Level &l : levels) {
+        std::printf("%8d %10.3f %12.6f %12.6f %12.3f\n", l.spp, l.seconds,
+                    l.error.rmse, l.error.relMSE,
+                    1.0 / std::max(l.error.relMSE * l.seconds, 1e-12));
+        if (!target && l.error.relMSE <= targetRelMSE) target = &l;
+    }
+    if (target) {
+        std::printf("relMSE %g reached at %d spp after %.3f seconds\n",
+                    targetRelMSE, target->spp, target->seconds);
+    } else {
+        std::printf("relMSE %g not reached\n", targetRelMSE);
+    }
+    return levels.back().error.relMSE;
+}
+
+// In the main function of the program, we load the scene (objects, lights,
+// camera and render options) from a scene file, apply the command line
+// overrides and call the render function().
 int main(int argc, char** argv)
 {
+    // "--scene file" selects the scene description, see SceneLoader.hpp
+    std::string scenePath = "../scenes/cornellbox.scene";
+    // "--stats file" also writes the render statistics as JSON
+    std::string statsPath;
+    // "--pfm file" also writes the image as floats
+    std::string pfmPath;
+    // "--compare reference.pfm" measures the convergence instead of rendering
+    // once, "--target-relmse x" is the error whose time is reported and
+    // "--max-relmse x" makes the run fail if the final error is above x
+    std::string referencePath;
+    double targetRelMSE = 0.01;
+    double maxRelMSE = -1;
+    // "--preview n" renders interactively at 1/n of the resolution to
+    // preview.ppm, with edits read from stdin (see Preview.hpp)
+    int previewScale = 0;
+    // "--serve socket" renders the jobs sent to a Unix domain socket until
+    // one asks for shutdown, see RenderServer.hpp
+    std::string socketPath;
+    // "--threads n" sets the number of render threads (default one per
+    // physical core) and "--pin-threads 1" pins each to a logical CPU,
+    // spread over the NUMA nodes
+    int threads = 0;
+    bool pinThreads = false;
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) == "--scene") {
+            scenePath = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--stats") {
+            statsPath = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--pfm") {
+            pfmPath = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--compare") {
+            referencePath = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--target-relmse") {
+            targetRelMSE = std::stod(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "--max-relmse") {
+            maxRelMSE = std::stod(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "--threads") {
+            threads = std::max(0, std::stoi(argv[++i]));
+        }
+        else if (std::string(argv[i]) == "--pin-threads") {
+            pinThreads = std::stoi(argv[++i]) != 0;
+        }
+        else if (std::string(argv[i]) == "--serve") {
+            socketPath = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--preview") {
+            previewScale = std::max(1, std::stoi(argv[++i]));
+        }
+    }
 
-    // Change the definition here to change resolution
-    Scene scene(784, 784);
-
-    init_random_device();
-
-    Material* red = new Material(DIFFUSE, Vector3f(0.0f));
-    red->Kd = Vector3f(0.63f, 0.065f, 0.05f);
-    red->Ks = Vector3f(0.63f, 0.065f, 0.05f);
-    red->ior = 1.46;
-    red->diffuseFactor = 1.0;
-    red->roughness = 1.0;
-    red->f0 = Vector3f(0.03, 0.03, 0.03);
-    red->h_alpha = 1.0;
-    red->metallic = 0.0f;
-
-    Material* green = new Material(DIFFUSE, Vector3f(0.0f));
-    green->Kd = Vector3f(0.14f, 0.45f, 0.091f);
-    green->Ks = Vector3f(0.14f, 0.45f, 0.091f);
-    green->ior = 1.46;
-    green->diffuseFactor = 1.0;
-    green->roughness = 1.0;
-    green->f0 = Vector3f(0.03, 0.03, 0.03);
-    green->h_alpha = 1.0;
-    green->metallic = 0.0f;
-
-    Material* white = new Material(DIFFUSE, Vector3f(0.0f));
-    white->Kd = Vector3f(0.725f, 0.71f, 0.68f);
-    white->Ks = Vector3f(0.725f, 0.71f, 0.68f);
-    white->ior = 1.46;
-    white->diffuseFactor = 1.0;
-    white->roughness = 1.0;
-    white->f0 = Vector3f(0.03, 0.03, 0.03);
-    white->h_alpha = 1.0;
-    white->metallic = 0.0f;
-
-    Material* copper = new Material(MICROFACET, Vector3f(0.0f));
-    copper->Kd = Vector3f(0.1914,0.125,0);
-    copper->Ks = Vector3f(0.5977);
-    copper->ior = 2.0f;
-    copper->diffuseFactor = 0.;
-    copper->roughness = 0.1;
-    copper->f0 = Vector3f(0.95, 0.64, 0.54);
-    copper->h_alpha = 0.2;
-    copper->metallic = 0.8f;
-
-
-    Material* mirror = new Material(MICROFACET, Vector3f(0.0f));
-    mirror->Kd = Vector3f(0.1914,0.125,0);
-    mirror->Ks = Vector3f(0.5977);
-    mirror->ior = 2.0f;
-    mirror->diffuseFactor = 0.;
-    mirror->roughness = 0.1;
-    mirror->f0 = Vector3f(1.00, 0.71, 0.29);
-    mirror->h_alpha = 0.0;
-    mirror->metallic = 0.8f;
-    
-
-    Material* light = new Material(DIFFUSE, 0.5*(8.0f * Vector3f(0.747f+0.058f, 0.747f+0.258f, 0.747f) + 15.6f * Vector3f(0.740f+0.287f,0.740f+0.160f,0.740f) + 18.4f *Vector3f(0.737f+0.642f,0.737f+0.159f,0.737f)));
-    light->Kd = Vector3f(0.65f);
-    light->Ks = Vector3f(0.65f);
-
-    MeshTriangle floor("../models/cornellbox/floor.obj", white);
-    MeshTriangle shortbox("../models/cornellbox/shortbox.obj", white);
-    MeshTriangle tallbox("../models/cornellbox/tallbox.obj", mirror);
-    // Sphere sphere = Sphere(Vector3f(300, 100, 300), 100, mirror);
-    // MeshTriangle bunny("../models/bunny/bunny.obj", mirror, Vector3f(300, 0, 300), Vector3f(2000));
-    MeshTriangle teapot("../models/teapot/teapot.obj", mirror, Vector3f(186, 166, 169), Vector3f(30));
-    MeshTriangle left("../models/cornellbox/left.obj", red);
-    MeshTriangle right("../models/cornellbox/right.obj", green);
-    MeshTriangle light_("../models/cornellbox/light.obj", light);
-
-    scene.Add(&floor);
-    scene.Add(&shortbox);
-    scene.Add(&tallbox);
-    // scene.Add(&bunny);
-    scene.Add(&teapot);
-    // scene.Add(&sphere);
-    scene.Add(&left);
-    scene.Add(&right);
-    scene.Add(&light_);
-
-    scene.buildBVH();
+    if (!socketPath.empty()) {
+        RenderServer server(socketPath);
+        server.threads = threads;
+        server.pinThreads = pinThreads;
+        return server.run() ? 0 : 1;
+    }
+
+    Scene scene;
+    scene.t_pool.threads = threads;
+    scene.t_pool.pin = pinThreads;
+    SceneLoader loader;
+    {
+        Stats::Timer loadTimer(Stats::LOAD);
+        if (!loader.load(scenePath, scene)) {
+            return 1;
+        }
+    }
+
+    // options given on the command line override the scene file
+    for (int i = 1; i + 1 < argc; ++i) {
+        // "--integrator path|mis|wavefront" selects the light transport algorithm
+        if (std::string(argv[i]) == "--integrator") {
+            std::string name = argv[++i];
+            if (name == "mis") scene.integrator = Scene::Integrator::MIS;
+            else if (name == "path") scene.integrator = Scene::Integrator::PATH;
+            else if (name == "wavefront") scene.integrator = Scene::Integrator::WAVEFRONT;
+            else std::cerr << "Unknown integrator: " << name << "\n";
+        }
+        // "--light-sampler power|bvh" selects how emitters are chosen
+        else if (std::string(argv[i]) == "--light-sampler") {
+            std::string name = argv[++i];
+            if (name == "bvh") scene.lightSampling = Scene::LightSampling::LIGHT_BVH;
+            else if (name == "power") scene.lightSampling = Scene::LightSampling::POWER;
+            else std::cerr << "Unknown light sampler: " << name << "\n";
+        }
+        else if (std::string(argv[i]) == "--max-depth") {
+            scene.maxDepth = std::stoi(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "--spp") {
+            scene.spp = std::stoi(argv[++i]);
+        }
+        // "--frames n" renders n frames of the scene's animation, written
+        // to binary_0000.ppm, binary_0001.ppm, ...
+        else if (std::string(argv[i]) == "--frames") {
+            scene.frames = std::max(1, std::stoi(argv[++i]));
+        }
+        // "--primary-samples n" shares n primary hits among the samples of
+        // a pixel with jittered camera rays, see Scene::primarySamples
+        else if (std::string(argv[i]) == "--primary-samples") {
+            scene.primarySamples = std::max(0, std::stoi(argv[++i]));
+        }
+        else if (std::string(argv[i]) == "--seed") {
+            scene.seed = std::stoul(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "--resolution" && i + 2 < argc) {
+            scene.width = std::stoi(argv[++i]);
+            scene.height = std::stoi(argv[++i]);
+        }
+    }
+
+    {
+        Stats::Timer buildTimer(Stats::BUILD);
+        scene.buildBVH();
+    }
 
     Renderer r;
 
+    if (previewScale > 0) {
+        Preview(scene, loader, r).run(std::cin, "preview.ppm", previewScale);
+        return 0;
+    }
+
+    if (!referencePath.empty()) {
+        double relMSE = compareConvergence(r, scene, referencePath, targetRelMSE);
+        if (relMSE < 0) return 1;
+        if (std::isnan(relMSE)) {
+            std::cerr << "Image cannot be compared with " << referencePath << "\n";
+            return 1;
+        }
+        // written so that a NaN fails as well
+        if (maxRelMSE >= 0 && !(relMSE <= maxRelMSE)) {
+            std::cerr << "relMSE " << relMSE << " is above " << maxRelMSE << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
     auto start = std::chrono::system_clock::now();
-    r.Render(scene);
+    for (int frame = 0; frame < scene.frames; ++frame) {
+        if (frame > 0) {
+            // only the animated objects are updated, everything else is
+            // kept from the previous frame
+            Stats::Timer buildTimer(Stats::BUILD);
+            loader.setFrame(scene, frame);
+        }
+        if (scene.frames > 1)
+            std::cout << "Frame " << frame + 1 << "/" << scene.frames << "\n";
+        // every view is rendered against the same scene and BVHs
+        for (const Camera &camera : scene.cameras) {
+            if (scene.cameras.size() > 1)
+                std::cout << "Camera " << camera.name << "\n";
+            r.Render(scene, camera, outputPath("binary.ppm", scene, camera, frame),
+                     outputPath(pfmPath, scene, camera, frame));
+        }
+    }
     auto stop = std::chrono::system_clock::now();
 
     std::cout << "Render complete: \n";
@@ -107,6 +252,10 @@ int main(int argc, char** argv)
     std::cout << "          : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() << " minutes\n";
     std::cout << "          : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() << " seconds\n";
 
-    delete_random_device();
+    Stats::print(std::cout);
+    if (!statsPath.empty() && !Stats::writeJson(statsPath)) {
+        std::cerr << "Cannot write statistics to " << statsPath << "\n";
+    }
+
     return 0;
 }
\ No newline at end of file